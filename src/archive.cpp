@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <cstring>
+
+#include <zlib.h>
+
+#include "archive.h"
+#include "exceptions.h"
+
+static uint64_t align_up(uint64_t offset) {
+    return (offset + ARCHIVE_ALIGNMENT - 1) / ARCHIVE_ALIGNMENT *
+           ARCHIVE_ALIGNMENT;
+}
+
+void ArchiveWriter::add(std::string name, std::span<const char> data,
+                        bool compress) {
+    Pending entry;
+    entry.name = std::move(name);
+    entry.uncompressed_size = data.size();
+    entry.compression = ArchiveCompression::None;
+    if (compress) {
+        auto compressed = archive_compress(data);
+        if (compressed.size() < data.size()) {
+            entry.data = std::move(compressed);
+            entry.compression = ArchiveCompression::Zlib;
+        }
+    }
+    if (entry.compression == ArchiveCompression::None) {
+        entry.data.assign(data.begin(), data.end());
+    }
+    m_entries.push_back(std::move(entry));
+}
+
+std::vector<char> ArchiveWriter::build() {
+    std::sort(m_entries.begin(), m_entries.end(),
+              [](const auto &a, const auto &b) { return a.name < b.name; });
+    for (size_t i = 1; i < m_entries.size(); i++) {
+        if (m_entries[i - 1].name == m_entries[i].name) {
+            throw DataException("Duplicate archive entry: " +
+                                m_entries[i].name);
+        }
+    }
+
+    ArchiveHeader header;
+    memcpy(header.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+    header.version = ARCHIVE_VERSION;
+    header.entry_count = m_entries.size();
+    header.names_offset =
+        sizeof(ArchiveHeader) + m_entries.size() * sizeof(ArchiveEntry);
+    header.names_size = 0;
+    for (const auto &entry : m_entries) {
+        header.names_size += entry.name.size();
+    }
+
+    std::vector<ArchiveEntry> entries;
+    uint64_t name_offset = header.names_offset;
+    uint64_t offset = align_up(header.names_offset + header.names_size);
+    for (const auto &pending : m_entries) {
+        ArchiveEntry entry;
+        entry.name_offset = name_offset;
+        entry.name_size = pending.name.size();
+        entry.compression = pending.compression;
+        entry.offset = offset;
+        entry.size = pending.data.size();
+        entry.uncompressed_size = pending.uncompressed_size;
+        entries.push_back(entry);
+        name_offset += pending.name.size();
+        offset = align_up(offset + pending.data.size());
+    }
+
+    std::vector<char> bytes(offset);
+    memcpy(bytes.data(), &header, sizeof(ArchiveHeader));
+    memcpy(bytes.data() + sizeof(ArchiveHeader), entries.data(),
+           entries.size() * sizeof(ArchiveEntry));
+    for (size_t i = 0; i < entries.size(); i++) {
+        const auto &pending = m_entries[i];
+        memcpy(bytes.data() + entries[i].name_offset, pending.name.data(),
+               pending.name.size());
+        memcpy(bytes.data() + entries[i].offset, pending.data.data(),
+               pending.data.size());
+    }
+    return bytes;
+}
+
+std::vector<char> archive_compress(std::span<const char> data) {
+    uLongf size = compressBound(data.size());
+    std::vector<char> compressed(size);
+    const auto result =
+        compress2((Bytef *)compressed.data(), &size,
+                  (const Bytef *)data.data(), data.size(), Z_BEST_COMPRESSION);
+    if (result != Z_OK) {
+        throw SystemException("Failed to compress archive entry");
+    }
+    compressed.resize(size);
+    return compressed;
+}
+
+std::vector<char> archive_decompress(std::span<const char> data,
+                                     uint64_t uncompressed_size) {
+    std::vector<char> bytes(uncompressed_size);
+    uLongf size = uncompressed_size;
+    const auto result = uncompress((Bytef *)bytes.data(), &size,
+                                   (const Bytef *)data.data(), data.size());
+    if (result != Z_OK || size != uncompressed_size) {
+        throw DataException("Corrupt archive entry");
+    }
+    return bytes;
+}
@@ -0,0 +1,73 @@
+#ifndef ARCHIVE_H_INCLUDED
+#define ARCHIVE_H_INCLUDED
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Asset archive layout:
+//
+//   ArchiveHeader
+//   ArchiveEntry[entry_count], sorted by name
+//   names, concatenated without separators
+//   payloads, each aligned to ARCHIVE_ALIGNMENT
+//
+// All offsets are from the start of the file. Names are asset paths
+// relative to the asset root, using '/' as the separator and without a
+// leading slash.
+
+const char ARCHIVE_MAGIC[8] = {'E', 'N', 'G', 'Y', 'P', 'A', 'K', 0};
+const uint32_t ARCHIVE_VERSION = 1;
+const uint64_t ARCHIVE_ALIGNMENT = 16;
+
+enum class ArchiveCompression : uint32_t {
+    None = 0,
+    Zlib = 1,
+};
+
+struct ArchiveHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_count;
+    uint64_t names_offset;
+    uint64_t names_size;
+};
+
+struct ArchiveEntry {
+    uint64_t name_offset;
+    uint32_t name_size;
+    ArchiveCompression compression;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t uncompressed_size;
+};
+
+static_assert(sizeof(ArchiveHeader) == 32);
+static_assert(sizeof(ArchiveEntry) == 40);
+
+/// @brief Assembles an archive in memory.
+class ArchiveWriter {
+    struct Pending {
+        std::string name;
+        std::vector<char> data;
+        ArchiveCompression compression;
+        uint64_t uncompressed_size;
+    };
+
+    std::vector<Pending> m_entries;
+
+public:
+    /// @brief Adds a file. If `compress` is set, the file is stored
+    /// compressed unless that doesn't save any space.
+    void add(std::string name, std::span<const char> data, bool compress);
+    size_t size() const { return m_entries.size(); }
+    std::vector<char> build();
+};
+
+std::vector<char> archive_compress(std::span<const char> data);
+std::vector<char> archive_decompress(std::span<const char> data,
+                                     uint64_t uncompressed_size);
+
+#endif
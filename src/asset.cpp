@@ -1,41 +1,228 @@
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <format>
 #include <fstream>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "archive.h"
 #include "asset.h"
 
+AssetView AssetView::from_vector(std::vector<byte> bytes) {
+    auto owner = std::make_shared<const std::vector<byte>>(std::move(bytes));
+    const std::span<const byte> data{*owner};
+    return AssetView{std::move(owner), data};
+}
+
 DirectoryAssetResolver::DirectoryAssetResolver(std::string &&root)
     : m_root(std::move(root)) {}
 
-std::vector<char> DirectoryAssetResolver::resolve(const std::string &path) {
-    std::string real_path;
+std::string DirectoryAssetResolver::real_path(const std::string &path) const {
     if (path[0] == '/') {
-        real_path = m_root + path;
+        return m_root + path;
     } else {
-        real_path = m_root + '/' + path;
+        return m_root + '/' + path;
     }
+}
 
-    std::ifstream f(real_path, std::ios_base::binary);
+AssetView DirectoryAssetResolver::resolve(const std::string &path) {
+    const auto real_path = this->real_path(path);
+    std::ifstream f(real_path, std::ios_base::binary | std::ios_base::ate);
+    if (!f.good()) {
+        throw SystemException(std::format("Cannot read file: {}", real_path));
+    }
+    // Read the whole file in one go rather than through a stream
+    // iterator
+    std::vector<byte> bytes(f.tellg());
+    f.seekg(0);
+    f.read(bytes.data(), bytes.size());
     if (!f.good()) {
         throw SystemException(std::format("Cannot read file: {}", real_path));
     }
-    return std::vector(std::istreambuf_iterator{f}, {});
+    return AssetView::from_vector(std::move(bytes));
+}
+
+bool DirectoryAssetResolver::exists(const std::string &path) {
+    return std::filesystem::is_regular_file(real_path(path));
+}
+
+ArchiveAssetResolver::ArchiveAssetResolver(const std::string &archive_path) {
+    const int fd = open(archive_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw SystemException(
+            std::format("Cannot open archive: {}", archive_path));
+    }
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        throw SystemException(
+            std::format("Cannot stat archive: {}", archive_path));
+    }
+    const size_t size = st.st_size;
+    void *data = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)
+                      : MAP_FAILED;
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+    if (data == MAP_FAILED) {
+        throw SystemException(
+            std::format("Cannot map archive: {}", archive_path));
+    }
+    m_size = size;
+    m_mapping = std::shared_ptr<const char>(
+        (const char *)data, [size](const char *p) { munmap((void *)p, size); });
+    const char *base = m_mapping.get();
+
+    ArchiveHeader header;
+    if (m_size < sizeof(ArchiveHeader)) {
+        throw DataException("Truncated archive header");
+    }
+    memcpy(&header, base, sizeof(ArchiveHeader));
+    const uint64_t entries_end = sizeof(ArchiveHeader) +
+                                 (uint64_t)header.entry_count *
+                                     sizeof(ArchiveEntry);
+    if (memcmp(header.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) ||
+        header.version != ARCHIVE_VERSION || entries_end > m_size) {
+        throw DataException(std::format("Invalid archive: {}", archive_path));
+    }
+    m_entries = {(const ArchiveEntry *)(base + sizeof(ArchiveHeader)),
+                 header.entry_count};
+    for (const auto &entry : m_entries) {
+        if (entry.name_offset + entry.name_size > m_size ||
+            entry.offset + entry.size > m_size) {
+            throw DataException(
+                std::format("Corrupt archive: {}", archive_path));
+        }
+    }
+}
+
+std::string_view ArchiveAssetResolver::name(const ArchiveEntry &entry) const {
+    return {m_mapping.get() + entry.name_offset, entry.name_size};
+}
+
+const ArchiveEntry *
+ArchiveAssetResolver::find(const std::string &path) const {
+    std::string_view key = path;
+    if (key.starts_with('/')) {
+        key.remove_prefix(1);
+    }
+    const auto it = std::lower_bound(
+        m_entries.begin(), m_entries.end(), key,
+        [this](const auto &entry, auto key) { return name(entry) < key; });
+    if (it == m_entries.end() || name(*it) != key) {
+        return nullptr;
+    }
+    return &*it;
+}
+
+AssetView ArchiveAssetResolver::resolve(const std::string &path) {
+    const auto *entry = find(path);
+    if (!entry) {
+        throw ResolutionException(std::format("No such asset: {}", path));
+    }
+    const std::span<const char> payload{m_mapping.get() + entry->offset,
+                                        entry->size};
+    switch (entry->compression) {
+    case ArchiveCompression::None:
+        return AssetView{m_mapping, payload, true};
+    case ArchiveCompression::Zlib:
+        return AssetView::from_vector(
+            archive_decompress(payload, entry->uncompressed_size));
+    default:
+        throw DataException(std::format("Unknown compression: {}", path));
+    }
+}
+
+bool ArchiveAssetResolver::exists(const std::string &path) {
+    return find(path) != nullptr;
+}
+
+AssetView CachingAssetResolver::resolve(const std::string &path) {
+    {
+        std::lock_guard lock{m_mutex};
+        auto it = m_entries.find(path);
+        if (it != m_entries.end()) {
+            m_lru.splice(m_lru.begin(), m_lru, it->second);
+            m_stats.hits++;
+            return it->second->view;
+        }
+        m_stats.misses++;
+    }
+
+    // Load without holding the lock so other threads aren't blocked on
+    // I/O. Two threads missing on the same path both load it; the
+    // second insert is dropped.
+    auto view = m_inner->resolve(path);
+    if (view.mapped() || view.size() > m_budget) {
+        return view;
+    }
+
+    std::lock_guard lock{m_mutex};
+    if (!m_entries.contains(path)) {
+        evict(view.size());
+        m_lru.push_front({path, view});
+        m_entries.insert({path, m_lru.begin()});
+        m_stats.bytes += view.size();
+    }
+    return view;
+}
+
+void CachingAssetResolver::evict(size_t incoming) {
+    while (!m_lru.empty() && m_stats.bytes + incoming > m_budget) {
+        const auto &entry = m_lru.back();
+        m_stats.bytes -= entry.view.size();
+        m_stats.evictions++;
+        m_entries.erase(entry.path);
+        m_lru.pop_back();
+    }
+}
+
+bool CachingAssetResolver::exists(const std::string &path) {
+    {
+        std::lock_guard lock{m_mutex};
+        if (m_entries.contains(path)) {
+            return true;
+        }
+    }
+    return m_inner->exists(path);
+}
+
+AssetCacheStats CachingAssetResolver::stats() {
+    std::lock_guard lock{m_mutex};
+    return m_stats;
+}
+
+void CachingAssetResolver::clear() {
+    std::lock_guard lock{m_mutex};
+    m_entries.clear();
+    m_lru.clear();
+    m_stats.bytes = 0;
 }
 
 AssetApi::AssetApi(std::unique_ptr<AssetResolver> &&resolver)
     : m_resolver(std::move(resolver)) {}
 
-std::vector<byte> AssetApi::load_blob(const std::string &path) {
+AssetView AssetApi::load_blob(const std::string &path) {
     return m_resolver->resolve(path);
 }
 
-std::string AssetApi::load_text(const std::string &path) {
-    auto bytes = m_resolver->resolve(path);
-    return std::string(bytes.begin(), bytes.end());
+bool AssetApi::exists(const std::string &path) {
+    return m_resolver->exists(path);
+}
+
+AssetView AssetApi::load_text(const std::string &path) {
+    return m_resolver->resolve(path);
 }
 
 Image AssetApi::load_image(const std::string &path) {
-    auto bytes = m_resolver->resolve(path);
+    const auto bytes = m_resolver->resolve(path);
+    if (Image::is_tex(bytes)) {
+        return Image::load_tex(bytes);
+    }
     return Image::load(bytes);
 }
@@ -2,27 +2,128 @@
 #define ASSET_H_INCLUDED
 
 #include <fstream>
+#include <list>
 #include <memory>
+#include <mutex>
+#include <span>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <variant>
 #include <vector>
 
+#include "archive.h"
 #include "exceptions.h"
 #include "image.h"
 
 typedef char byte;
 
+/// @brief Read-only view of an asset's contents. The view shares
+/// ownership of whatever backs the bytes, e.g. a memory-mapped archive
+/// or a buffer read from disk, so it stays valid however long it is
+/// held and can be copied freely without copying the data.
+class AssetView {
+    std::shared_ptr<const void> m_owner;
+    std::span<const byte> m_data;
+    bool m_mapped = false;
+
+public:
+    AssetView() = default;
+    /// `mapped` marks views into a memory mapping shared with other
+    /// assets, which cost nothing to resolve again.
+    AssetView(std::shared_ptr<const void> owner, std::span<const byte> data,
+              bool mapped = false)
+        : m_owner{std::move(owner)}, m_data{data}, m_mapped{mapped} {}
+
+    /// @brief Wraps a buffer that no one else owns.
+    static AssetView from_vector(std::vector<byte> bytes);
+
+    std::span<const byte> data() const { return m_data; }
+    std::string_view text() const { return {m_data.data(), m_data.size()}; }
+    size_t size() const { return m_data.size(); }
+    bool empty() const { return m_data.empty(); }
+    bool mapped() const { return m_mapped; }
+
+    operator std::span<const byte>() const { return m_data; }
+};
+
 struct AssetResolver {
-    virtual std::vector<byte> resolve(const std::string &path) = 0;
+    virtual AssetView resolve(const std::string &path) = 0;
+    virtual bool exists(const std::string &path) = 0;
 };
 
-/// Loads files off of disk based on file path, uncached.
+/// Loads files off of disk based on file path, uncached. Wrap in a
+/// CachingAssetResolver to keep hot assets in memory.
 class DirectoryAssetResolver : public AssetResolver {
     std::string m_root;
 
+    std::string real_path(const std::string &path) const;
+
 public:
     DirectoryAssetResolver(std::string &&root);
-    virtual std::vector<byte> resolve(const std::string &path);
+    virtual AssetView resolve(const std::string &path);
+    virtual bool exists(const std::string &path);
+};
+
+/// Serves assets out of a single memory-mapped archive built by the
+/// pack tool. Uncompressed assets are returned as views straight into
+/// the mapping, which lives until the last view of it is dropped.
+class ArchiveAssetResolver : public AssetResolver {
+    std::shared_ptr<const char> m_mapping;
+    size_t m_size = 0;
+    std::span<const ArchiveEntry> m_entries;
+
+    std::string_view name(const ArchiveEntry &entry) const;
+    const ArchiveEntry *find(const std::string &path) const;
+
+public:
+    ArchiveAssetResolver(const std::string &archive_path);
+
+    virtual AssetView resolve(const std::string &path);
+    virtual bool exists(const std::string &path);
+};
+
+const size_t ASSET_CACHE_BUDGET = 0x400'0000;
+
+struct AssetCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    /// Total size of the assets currently cached.
+    size_t bytes = 0;
+};
+
+/// Wraps another resolver and keeps recently used assets in memory, up
+/// to a total size. Cached views are shared with every caller, so a hit
+/// costs neither I/O nor an allocation. Mapped views are passed through
+/// uncached: they are already free to resolve, and caching them would
+/// only spend the budget. Safe to use from multiple threads.
+class CachingAssetResolver : public AssetResolver {
+    struct Entry {
+        std::string path;
+        AssetView view;
+    };
+
+    std::unique_ptr<AssetResolver> m_inner;
+    size_t m_budget;
+    std::mutex m_mutex;
+    // Most recently used first
+    std::list<Entry> m_lru;
+    std::unordered_map<std::string, std::list<Entry>::iterator> m_entries;
+    AssetCacheStats m_stats;
+
+    void evict(size_t incoming);
+
+public:
+    CachingAssetResolver(std::unique_ptr<AssetResolver> inner,
+                         size_t budget = ASSET_CACHE_BUDGET)
+        : m_inner{std::move(inner)}, m_budget{budget} {}
+
+    virtual AssetView resolve(const std::string &path);
+    virtual bool exists(const std::string &path);
+
+    AssetCacheStats stats();
+    void clear();
 };
 
 class AssetApi {
@@ -31,8 +132,11 @@ class AssetApi {
 public:
     AssetApi(std::unique_ptr<AssetResolver> &&resolver);
 
-    std::vector<byte> load_blob(const std::string &path);
-    std::string load_text(const std::string &path);
+    AssetView load_blob(const std::string &path);
+    bool exists(const std::string &path);
+    /// @brief Same as load_blob; read the contents through text().
+    AssetView load_text(const std::string &path);
+    /// @brief Loads a PNG or a .tex file, depending on its contents.
     Image load_image(const std::string &path);
 };
 
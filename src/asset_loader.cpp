@@ -0,0 +1,97 @@
+#include <exception>
+
+#include "asset_loader.h"
+
+AsyncAssetLoader::AsyncAssetLoader(AssetApi &assets, size_t thread_count)
+    : m_assets{assets} {
+    for (size_t i = 0; i < thread_count; i++) {
+        m_threads.emplace_back([this]() { work(); });
+    }
+}
+
+AsyncAssetLoader::~AsyncAssetLoader() {
+    {
+        std::lock_guard lock{m_mutex};
+        m_stopping = true;
+    }
+    m_condition.notify_all();
+    for (auto &thread : m_threads) {
+        thread.join();
+    }
+}
+
+AssetFuture AsyncAssetLoader::load(const std::string &path, int priority,
+                                   Callback on_complete) {
+    std::shared_ptr<Request> request;
+    {
+        std::lock_guard lock{m_mutex};
+        auto it = m_in_flight.find(path);
+        if (it != m_in_flight.end()) {
+            request = it->second;
+        } else {
+            request = std::make_shared<Request>();
+            request->path = path;
+            request->future = request->promise.get_future().share();
+            m_in_flight.insert({path, request});
+        }
+        if (on_complete) {
+            request->callbacks.push_back(std::move(on_complete));
+        }
+        // Queue again even if already queued so the highest priority
+        // any caller asked for wins
+        if (!request->started) {
+            m_queue.push({priority, m_sequence++, request});
+        }
+    }
+    m_condition.notify_one();
+    return request->future;
+}
+
+void AsyncAssetLoader::work() {
+    while (true) {
+        std::shared_ptr<Request> request;
+        {
+            std::unique_lock lock{m_mutex};
+            m_condition.wait(
+                lock, [this]() { return m_stopping || !m_queue.empty(); });
+            if (m_stopping) {
+                return;
+            }
+            request = m_queue.top().request;
+            m_queue.pop();
+            if (request->started) {
+                continue;
+            }
+            request->started = true;
+        }
+
+        try {
+            request->promise.set_value(m_assets.load_blob(request->path));
+        } catch (...) {
+            request->promise.set_exception(std::current_exception());
+        }
+
+        std::lock_guard lock{m_mutex};
+        m_in_flight.erase(request->path);
+        m_completed.push_back(std::move(request));
+    }
+}
+
+void AsyncAssetLoader::poll() {
+    std::vector<std::shared_ptr<Request>> completed;
+    {
+        std::lock_guard lock{m_mutex};
+        completed.swap(m_completed);
+    }
+    // Callbacks run without the lock held so they can queue more loads
+    for (const auto &request : completed) {
+        for (const auto &callback : request->callbacks) {
+            callback(request->future);
+        }
+    }
+}
+
+size_t AsyncAssetLoader::pending() {
+    std::lock_guard lock{m_mutex};
+    return m_in_flight.size();
+}
@@ -0,0 +1,89 @@
+#ifndef ASSET_LOADER_H_INCLUDED
+#define ASSET_LOADER_H_INCLUDED
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "asset.h"
+
+const size_t ASSET_LOADER_THREADS = 4;
+
+typedef std::shared_future<AssetView> AssetFuture;
+
+/// @brief Loads assets on a pool of I/O threads.
+///
+/// Requests for a path that is already being loaded share a single
+/// load. Queued requests are served highest priority first. Completion
+/// callbacks run on whichever thread calls poll(), normally the main
+/// thread once per frame, so they never race with rendering.
+class AsyncAssetLoader {
+public:
+    typedef std::function<void(const AssetFuture &)> Callback;
+
+private:
+    struct Request {
+        std::string path;
+        std::promise<AssetView> promise;
+        AssetFuture future;
+        std::vector<Callback> callbacks;
+        bool started = false;
+    };
+
+    struct QueueEntry {
+        int priority;
+        uint64_t sequence;
+        std::shared_ptr<Request> request;
+
+        bool operator<(const QueueEntry &other) const {
+            // Higher priority first, then first come first served
+            if (priority != other.priority) {
+                return priority < other.priority;
+            }
+            return sequence > other.sequence;
+        }
+    };
+
+    AssetApi &m_assets;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    // Raising the priority of a queued request pushes a second entry;
+    // entries for requests that have already started are skipped.
+    std::priority_queue<QueueEntry> m_queue;
+    std::unordered_map<std::string, std::shared_ptr<Request>> m_in_flight;
+    std::vector<std::shared_ptr<Request>> m_completed;
+    uint64_t m_sequence = 0;
+    bool m_stopping = false;
+    std::vector<std::thread> m_threads;
+
+    void work();
+
+public:
+    AsyncAssetLoader(AssetApi &assets,
+                     size_t thread_count = ASSET_LOADER_THREADS);
+    AsyncAssetLoader(const AsyncAssetLoader &other) = delete;
+    AsyncAssetLoader &operator=(const AsyncAssetLoader &other) = delete;
+    /// Requests that haven't started are abandoned; their futures
+    /// report a broken promise.
+    ~AsyncAssetLoader();
+
+    /// @brief Queues a load of `path`. If `on_complete` is given, it is
+    /// called from poll() once the load finishes or fails.
+    AssetFuture load(const std::string &path, int priority = 0,
+                     Callback on_complete = {});
+    /// @brief Runs the callbacks of every load that has finished since
+    /// the last call.
+    void poll();
+    /// @brief Number of loads queued or in progress.
+    size_t pending();
+};
+
+#endif
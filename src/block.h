@@ -28,6 +28,9 @@ public:
 
     void add(BlockInfo &&info);
     const BlockInfo &get(BlockType type) const;
+    const std::unordered_map<BlockType, BlockInfo> &blocks() const {
+        return m_block_info;
+    }
 };
 
 struct Block {
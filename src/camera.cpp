@@ -38,13 +38,20 @@ Matrix4 FirstPersonCameraRig::forward_transform() const {
     return Matrix4{-rot[1], -rot[2], rot[0], position.xyz1()};
 }
 
+Matrix4 FirstPersonCameraRig::interpolated_transform(float alpha) const {
+    auto rot = scene::pilot_angles_xform(yaw, pitch, 0);
+    auto blended = previous_position + alpha * (position - previous_position);
+    return Matrix4{-rot[1], -rot[2], rot[0], blended.xyz1()};
+}
+
 void FirstPersonCameraRig::on_mouse_move(float dx, float dy) {
     yaw -= MOUSE_LOOK_SENSITIVITY * dx;
     pitch += MOUSE_LOOK_SENSITIVITY * dy;
 }
 
-void FirstPersonCameraRig::ticker(const uint8_t *keystate) {
-    auto speed = MOUSE_LOOK_MOVE_SPEED;
+void FirstPersonCameraRig::ticker(const uint8_t *keystate, float dt) {
+    previous_position = position;
+    auto speed = MOUSE_LOOK_MOVE_SPEED * dt;
     if ((keystate[SDL_SCANCODE_LSHIFT] | keystate[SDL_SCANCODE_RSHIFT]) ==
         SDL_PRESSED) {
         speed *= 3;
@@ -9,10 +9,16 @@ struct CameraRig {
     virtual Matrix4 reverse_transform() const {
         return forward_transform().rigid_inverse();
     }
+    /// @brief Transform blended between the states before and after the
+    /// last tick; `alpha` runs from 0 to 1 between ticks.
+    virtual Matrix4 interpolated_transform(float alpha) const {
+        return forward_transform();
+    }
     virtual void on_mouse_move(float dx, float dy) {}
     virtual void on_mouse_drag(float dx, float dy, const uint8_t *keystate) {}
     virtual void on_mouse_scroll(float dx) {}
-    virtual void ticker(const uint8_t *keystate) {}
+    /// @brief Advances the rig by one simulation tick of `dt` seconds.
+    virtual void ticker(const uint8_t *keystate, float dt) {}
 };
 
 /// @brief Implements a camera rig with capabilities similar to a 3d
@@ -33,14 +39,19 @@ struct EditorCameraRig : public CameraRig {
 
 struct FirstPersonCameraRig : public CameraRig {
     Vector3 position;
+    // Position before the last tick
+    Vector3 previous_position;
     float yaw;
     float pitch;
 
     FirstPersonCameraRig() : yaw{0}, pitch{0} {}
 
     virtual Matrix4 forward_transform() const;
+    // Only the position is interpolated. Mouse look is applied as soon
+    // as it arrives rather than simulated, so it is always current.
+    virtual Matrix4 interpolated_transform(float alpha) const;
     virtual void on_mouse_move(float dx, float dy);
-    virtual void ticker(const uint8_t *keystate);
+    virtual void ticker(const uint8_t *keystate, float dt);
 };
 
 #endif
@@ -17,7 +17,10 @@ bool Block::is_solid() const {
 }
 
 void Chunk::update_mesh(VulkanRenderer &renderer, const MeshData &data) {
-    m_mesh.reset();
+    if (m_mesh) {
+        renderer.destroy_mesh(m_mesh);
+        m_mesh = {};
+    }
     if (data.vertices.empty() || data.indices.empty()) {
         return;
     }
@@ -26,21 +29,34 @@ void Chunk::update_mesh(VulkanRenderer &renderer, const MeshData &data) {
 }
 
 void ChunkMap::update_mesh(const BlockRegistry &block_registry,
+                           const BlockTextureTable &textures,
                            VulkanRenderer &renderer, ChunkPos pos) {
-    const auto data =
-        generate_mesh(block_registry, renderer.textures(), *this, pos);
+    const auto data = generate_mesh(block_registry, textures, *this, pos);
     (*this)[pos].update_mesh(renderer, data);
 }
 
+void ChunkMap::update_meshes(const BlockRegistry &block_registry,
+                             const BlockTextureTable &textures,
+                             VulkanRenderer &renderer,
+                             std::span<const ChunkPos> positions,
+                             JobSystem &jobs) {
+    // Meshing only reads the map; uploading goes through the staging
+    // buffer, which isn't thread-safe
+    std::vector<MeshData> meshes(positions.size());
+    jobs.parallel_for(positions.size(), [&](size_t i) {
+        meshes[i] =
+            generate_mesh(block_registry, textures, *this, positions[i]);
+    });
+    for (size_t i = 0; i < positions.size(); i++) {
+        at(positions[i]).update_mesh(renderer, meshes[i]);
+    }
+}
+
 float f(float x, float y) {
     return 4 + sinf(pi * x / 2) + sinf(pi * y / 2);
 }
 
-void ChunkMap::generate_chunk(ChunkPos pos) {
-    auto &chunk = (*this)[pos];
-    if (chunk.m_generated) {
-        return;
-    }
+static void generate_blocks(Chunk &chunk, ChunkPos pos) {
     chunk.pos() = pos;
     auto &blocks = chunk.data().blocks;
     for (int i = 0; i < 8; i++) {
@@ -54,5 +70,30 @@ void ChunkMap::generate_chunk(ChunkPos pos) {
             }
         }
     }
+}
+
+void ChunkMap::generate_chunk(ChunkPos pos) {
+    auto &chunk = (*this)[pos];
+    if (chunk.m_generated) {
+        return;
+    }
+    generate_blocks(chunk, pos);
     chunk.m_generated = true;
 }
+
+void ChunkMap::generate_chunks(std::span<const ChunkPos> positions,
+                               JobSystem &jobs) {
+    // Insert serially so the map isn't modified while jobs run
+    std::vector<Chunk *> chunks;
+    for (const auto &pos : positions) {
+        auto &chunk = (*this)[pos];
+        if (!chunk.m_generated) {
+            chunk.pos() = pos;
+            chunk.m_generated = true;
+            chunks.push_back(&chunk);
+        }
+    }
+    jobs.parallel_for(chunks.size(), [&](size_t i) {
+        generate_blocks(*chunks[i], chunks[i]->pos());
+    });
+}
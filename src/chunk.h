@@ -1,19 +1,20 @@
 #ifndef CHUNK_H_INCLUDED
 #define CHUNK_H_INCLUDED
 
-#include <optional>
 #include <span>
 #include <string_view>
 #include <unordered_map>
 #include <vector>
 
 #include "block.h"
+#include "jobs.h"
 #include "math/vector.h"
 #include "vulkan/mesh.h"
 #include "vulkan/renderer.h"
 #include "vulkan/staging.h"
 #include "vulkan/texture_map.h"
 
+class BlockTextureTable;
 class MeshData;
 
 struct ChunkPos {
@@ -48,7 +49,7 @@ struct ChunkData {
 class Chunk {
     ChunkPos m_pos;
     ChunkData m_data;
-    std::optional<Mesh> m_mesh;
+    Mesh m_mesh;
     bool m_generated = false;
 
     friend class ChunkMap;
@@ -61,7 +62,7 @@ public:
 
     ChunkData &data() { return m_data; }
     const ChunkData &data() const { return m_data; }
-    const std::optional<Mesh> &mesh() const { return m_mesh; }
+    Mesh mesh() const { return m_mesh; }
     bool generated() const { return m_generated; }
 
     void update_mesh(VulkanRenderer &renderer, const MeshData &data);
@@ -78,8 +79,17 @@ public:
     Chunk &operator[](ChunkPos pos) { return m_chunks[pos]; }
 
     void generate_chunk(ChunkPos pos);
+    /// @brief Generates every chunk in `positions` in parallel.
+    void generate_chunks(std::span<const ChunkPos> positions, JobSystem &jobs);
     void update_mesh(const BlockRegistry &block_registry,
+                     const BlockTextureTable &textures,
                      VulkanRenderer &renderer, ChunkPos pos);
+    /// @brief Meshes every chunk in `positions` in parallel, then
+    /// uploads the meshes on this thread. Must be called while staging.
+    void update_meshes(const BlockRegistry &block_registry,
+                       const BlockTextureTable &textures,
+                       VulkanRenderer &renderer,
+                       std::span<const ChunkPos> positions, JobSystem &jobs);
 };
 
 #endif
\ No newline at end of file
@@ -1,6 +1,7 @@
 #ifndef CONFIG_H_INCLUDED
 #define CONFIG_H_INCLUDED
 
+#include <cstdint>
 #include <numbers>
 
 const char *const WINDOW_TITLE = "engy";
@@ -15,6 +16,22 @@ const float MOUSE_PIVOT_SENSITIVITY = 0.003;
 const float MOUSE_PANNING_SENSITIVITY = 0.00225;
 const float MOUSE_ZOOM_SENSITIVITY = 0.1;
 const float MOUSE_LOOK_SENSITIVITY = 0.003;
-const float MOUSE_LOOK_MOVE_SPEED = 0.1;
+// Units per second
+const float MOUSE_LOOK_MOVE_SPEED = 6;
+
+// Simulation runs at a fixed rate regardless of frame rate
+const int SIMULATION_HZ = 60;
+// After a stall, at most this many ticks are run to catch up; the rest
+// of the lost time is dropped
+const int MAX_SIMULATION_TICKS_PER_FRAME = 5;
+
+// Frame rate while the window is in the background
+const float UNFOCUSED_FPS = 10;
+// How long to sleep when there is nothing new to render or simulate
+// before checking again
+const int IDLE_WAIT_MS = 100;
+
+// Frames rendered by a headless benchmark run unless told otherwise
+const uint32_t HEADLESS_FRAMES = 600;
 
 #endif
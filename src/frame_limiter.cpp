@@ -0,0 +1,25 @@
+#include <thread>
+
+#include "frame_limiter.h"
+
+void FrameLimiter::wait(float rate) {
+    const auto now = std::chrono::steady_clock::now();
+    if (rate <= 0) {
+        m_next = now;
+        return;
+    }
+    const auto period =
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<float>(1 / rate));
+    // Don't try to make up for frames that ran long or a rate change
+    if (m_next < now - period || m_next > now + period) {
+        m_next = now;
+    }
+    if (m_next - now > FRAME_LIMITER_SPIN) {
+        std::this_thread::sleep_until(m_next - FRAME_LIMITER_SPIN);
+    }
+    while (std::chrono::steady_clock::now() < m_next) {
+        std::this_thread::yield();
+    }
+    m_next += period;
+}
@@ -0,0 +1,20 @@
+#ifndef FRAME_LIMITER_H_INCLUDED
+#define FRAME_LIMITER_H_INCLUDED
+
+#include <chrono>
+
+// Sleeps overshoot by up to a scheduler tick, so the end of each wait
+// is spun instead
+const std::chrono::microseconds FRAME_LIMITER_SPIN{1000};
+
+/// @brief Paces a loop to a target rate.
+class FrameLimiter {
+    std::chrono::steady_clock::time_point m_next;
+
+public:
+    /// @brief Blocks until the next frame is due at `rate` frames per
+    /// second. A rate of 0 doesn't limit.
+    void wait(float rate);
+};
+
+#endif
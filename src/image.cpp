@@ -1,4 +1,7 @@
+#include <cassert>
 #include <cstdint>
+#include <cstring>
+#include <string>
 
 #include <GL/gl.h>
 #include <spng.h>
@@ -72,3 +75,138 @@ auto Image::load(std::span<const char> data) -> Image {
     result.m_format = pixel_format;
     return result;
 }
+
+Image Image::create(PixelFormat format, uint32_t width, uint32_t height,
+                    uint32_t mip_levels, std::vector<char> data) {
+    Image result;
+    result.m_width = width;
+    result.m_height = height;
+    result.m_format = format;
+    result.m_mip_levels = mip_levels;
+    result.m_data = std::move(data);
+    assert(result.m_data.size() == result.level_offset(mip_levels));
+    return result;
+}
+
+size_t ImageDesc::level_offset(uint32_t level) const {
+    size_t offset = 0;
+    for (uint32_t i = 0; i < level; i++) {
+        offset += image_size(format, level_width(i), level_height(i));
+    }
+    return offset;
+}
+
+std::span<const char> Image::level_data(uint32_t level) const {
+    assert(level < m_mip_levels);
+    const auto size = image_size(m_format, level_width(level),
+                                 level_height(level));
+    return data().subspan(level_offset(level), size);
+}
+
+bool Image::is_tex(std::span<const char> data) {
+    return data.size() >= sizeof(TEX_MAGIC) &&
+           !memcmp(data.data(), TEX_MAGIC, sizeof(TEX_MAGIC));
+}
+
+static TexHeader read_tex_header(std::span<const char> data) {
+    TexHeader header;
+    if (data.size() < sizeof(TexHeader)) {
+        throw DataException("Truncated texture header");
+    }
+    memcpy(&header, data.data(), sizeof(TexHeader));
+    if (memcmp(header.magic, TEX_MAGIC, sizeof(TEX_MAGIC))) {
+        throw DataException("Invalid texture magic");
+    }
+    if (header.version != TEX_VERSION) {
+        throw DataException("Unsupported texture version");
+    }
+    if (header.format > (uint32_t)PixelFormat::Bc7 || !header.width ||
+        !header.height || !header.mip_levels || header.mip_levels > 32) {
+        throw DataException("Invalid texture header");
+    }
+    const ImageDesc desc{(PixelFormat)header.format, header.width,
+                         header.height, header.mip_levels};
+    if (data.size() - sizeof(TexHeader) != desc.size()) {
+        throw DataException("Texture size mismatch");
+    }
+    return header;
+}
+
+auto Image::load_tex(std::span<const char> data) -> Image {
+    const auto header = read_tex_header(data);
+    const auto pixels = data.subspan(sizeof(TexHeader));
+    return Image::create((PixelFormat)header.format, header.width,
+                         header.height, header.mip_levels,
+                         {pixels.begin(), pixels.end()});
+}
+
+std::vector<char> Image::save_tex() const {
+    TexHeader header;
+    memcpy(header.magic, TEX_MAGIC, sizeof(TEX_MAGIC));
+    header.version = TEX_VERSION;
+    header.format = (uint32_t)m_format;
+    header.width = m_width;
+    header.height = m_height;
+    header.mip_levels = m_mip_levels;
+
+    std::vector<char> bytes(sizeof(TexHeader) + m_data.size());
+    memcpy(bytes.data(), &header, sizeof(TexHeader));
+    memcpy(bytes.data() + sizeof(TexHeader), m_data.data(), m_data.size());
+    return bytes;
+}
+
+std::vector<char> Image::save_ppm() const {
+    if (m_format != PixelFormat::Rgb8 && m_format != PixelFormat::Rgba8) {
+        throw DataException("PPM only supports RGB images");
+    }
+    const auto header =
+        "P6\n" + std::to_string(m_width) + " " + std::to_string(m_height) +
+        "\n255\n";
+    const auto pixel_size = format_size(m_format);
+    std::vector<char> bytes(header.begin(), header.end());
+    bytes.reserve(header.size() + size_t(m_width) * m_height * 3);
+    for (size_t i = 0; i < size_t(m_width) * m_height; i++) {
+        const auto *pixel = &m_data[i * pixel_size];
+        bytes.insert(bytes.end(), pixel, pixel + 3);
+    }
+    return bytes;
+}
+
+ImageDesc Image::peek(std::span<const char> data) {
+    if (is_tex(data)) {
+        const auto header = read_tex_header(data);
+        return {(PixelFormat)header.format, header.width, header.height,
+                header.mip_levels};
+    }
+
+    SpngCtx ctx;
+    spng_set_png_buffer(ctx.inner, data.data(), data.size());
+    spng_ihdr ihdr;
+    if (spng_get_ihdr(ctx.inner, &ihdr)) {
+        throw DataException("Invalid PNG");
+    }
+    return {PixelFormat::Rgba8, ihdr.width, ihdr.height, 1};
+}
+
+void Image::decode_into(std::span<const char> data, std::span<char> out) {
+    if (is_tex(data)) {
+        const auto pixels = data.subspan(sizeof(TexHeader));
+        if (pixels.size() != out.size()) {
+            throw DataException("Texture size mismatch");
+        }
+        memcpy(out.data(), pixels.data(), pixels.size());
+        return;
+    }
+
+    SpngCtx ctx;
+    spng_set_png_buffer(ctx.inner, data.data(), data.size());
+    size_t size;
+    if (spng_decoded_image_size(ctx.inner, SPNG_FMT_RGBA8, &size) ||
+        size != out.size()) {
+        throw DataException("Invalid PNG");
+    }
+    if (spng_decode_image(ctx.inner, out.data(), out.size(), SPNG_FMT_RGBA8,
+                          0)) {
+        throw DataException("Failed to decode PNG");
+    }
+}
@@ -1,6 +1,8 @@
 #ifndef IMAGE_H_INCLUDED
 #define IMAGE_H_INCLUDED
 
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
 #include <span>
 #include <vector>
@@ -12,8 +14,24 @@ enum class PixelFormat {
     Rg8,
     Rgb8,
     Rgba8,
+    Bc1,
+    Bc3,
+    Bc7,
 };
 
+inline bool format_compressed(PixelFormat format) {
+    return format == PixelFormat::Bc1 || format == PixelFormat::Bc3 ||
+           format == PixelFormat::Bc7;
+}
+
+/// @brief Width and height in pixels of a block of the format. Always
+/// 1 for uncompressed formats.
+inline uint32_t format_block_extent(PixelFormat format) {
+    return format_compressed(format) ? 4 : 1;
+}
+
+/// @brief Size in bytes of a single pixel. Only valid for uncompressed
+/// formats.
 inline uint32_t format_size(PixelFormat format) {
     switch (format) {
     case PixelFormat::R8:
@@ -29,6 +47,28 @@ inline uint32_t format_size(PixelFormat format) {
     }
 }
 
+/// @brief Size in bytes of a block of the format.
+inline uint32_t format_block_size(PixelFormat format) {
+    switch (format) {
+    case PixelFormat::Bc1:
+        return 8;
+    case PixelFormat::Bc3:
+    case PixelFormat::Bc7:
+        return 16;
+    default:
+        return format_size(format);
+    }
+}
+
+/// @brief Size in bytes of a single mip level.
+inline size_t image_size(PixelFormat format, uint32_t width,
+                         uint32_t height) {
+    const auto extent = format_block_extent(format);
+    const size_t blocks_x = (width + extent - 1) / extent;
+    const size_t blocks_y = (height + extent - 1) / extent;
+    return blocks_x * blocks_y * format_block_size(format);
+}
+
 inline vk::Format format_to_vk(PixelFormat format) {
     switch (format) {
     case PixelFormat::R8:
@@ -39,6 +79,12 @@ inline vk::Format format_to_vk(PixelFormat format) {
         return vk::Format::eR8G8B8Srgb;
     case PixelFormat::Rgba8:
         return vk::Format::eR8G8B8A8Srgb;
+    case PixelFormat::Bc1:
+        return vk::Format::eBc1RgbaSrgbBlock;
+    case PixelFormat::Bc3:
+        return vk::Format::eBc3SrgbBlock;
+    case PixelFormat::Bc7:
+        return vk::Format::eBc7SrgbBlock;
     default:
         abort();
     }
@@ -54,15 +100,60 @@ inline PixelFormat vk_to_format(vk::Format format) {
         return PixelFormat::Rgb8;
     case vk::Format::eR8G8B8A8Srgb:
         return PixelFormat::Rgba8;
+    case vk::Format::eBc1RgbaSrgbBlock:
+        return PixelFormat::Bc1;
+    case vk::Format::eBc3SrgbBlock:
+        return PixelFormat::Bc3;
+    case vk::Format::eBc7SrgbBlock:
+        return PixelFormat::Bc7;
     default:
         abort();
     }
 }
 
+/// Magic number at the start of a .tex file.
+const char TEX_MAGIC[8] = {'E', 'N', 'G', 'Y', 'T', 'E', 'X', 0};
+const uint32_t TEX_VERSION = 1;
+
+/// @brief Header of a .tex file. The header is followed by the mip
+/// levels in order, largest first, each tightly packed.
+struct TexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mip_levels;
+};
+
+static_assert(sizeof(TexHeader) == 28);
+
+/// @brief Format and dimensions of an image, without its pixels.
+struct ImageDesc {
+    PixelFormat format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mip_levels = 1;
+
+    uint32_t level_width(uint32_t level) const {
+        return std::max(width >> level, 1u);
+    }
+    uint32_t level_height(uint32_t level) const {
+        return std::max(height >> level, 1u);
+    }
+    /// @brief Offset of a mip level when levels are tightly packed.
+    /// Passing `mip_levels` gives the size of the whole image.
+    size_t level_offset(uint32_t level) const;
+    size_t size() const { return level_offset(mip_levels); }
+};
+
+/// @brief Pixel data of an image, possibly with a precomputed mip
+/// chain stored after the base level.
 class Image {
     std::vector<char> m_data;
     PixelFormat m_format;
     uint32_t m_width, m_height;
+    uint32_t m_mip_levels = 1;
 
     Image() = default;
 
@@ -71,15 +162,53 @@ class Image {
 public:
     Image(const Image &other) = delete;
     Image(Image &&other) = default;
+    Image &operator=(Image &&other) = default;
+
+    static Image create(PixelFormat format, uint32_t width, uint32_t height,
+                        uint32_t mip_levels, std::vector<char> data);
 
     std::span<const char> data() const {
         return {m_data.begin(), m_data.end()};
     }
     PixelFormat format() const { return m_format; }
     uint32_t width() const { return m_width; }
-    uint32_t height() const { return m_width; }
+    uint32_t height() const { return m_height; }
+    uint32_t mip_levels() const { return m_mip_levels; }
+    ImageDesc desc() const {
+        return {m_format, m_width, m_height, m_mip_levels};
+    }
+
+    uint32_t level_width(uint32_t level) const {
+        return desc().level_width(level);
+    }
+    uint32_t level_height(uint32_t level) const {
+        return desc().level_height(level);
+    }
+    /// @brief Offset of a mip level within data().
+    size_t level_offset(uint32_t level) const {
+        return desc().level_offset(level);
+    }
+    std::span<const char> level_data(uint32_t level) const;
 
+    /// @brief Decodes a PNG.
     static Image load(std::span<const char> data);
+    /// @brief Reads a .tex file, which holds a mip chain in any pixel
+    /// format and needs no decoding.
+    static Image load_tex(std::span<const char> data);
+    static bool is_tex(std::span<const char> data);
+    std::vector<char> save_tex() const;
+    /// @brief Encodes the base level as a binary PPM, dropping alpha.
+    /// Only RGB8 and RGBA8 images are supported.
+    std::vector<char> save_ppm() const;
+
+    /// @brief Reads the description of a PNG or .tex file without
+    /// decoding it. PNGs are described as RGBA8, whatever their
+    /// channels, which is what decode_into produces for them.
+    static ImageDesc peek(std::span<const char> data);
+    /// @brief Decodes a PNG or .tex file into `out`, which must be
+    /// exactly `peek(data).size()` bytes. Conversion to RGBA8 happens
+    /// as part of decoding, so no intermediate buffer is needed.
+    static void decode_into(std::span<const char> data, std::span<char> out);
 };
 
 #endif
\ No newline at end of file
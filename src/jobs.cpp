@@ -0,0 +1,238 @@
+#include <cassert>
+#include <utility>
+
+#include "jobs.h"
+
+// Which system's deque, if any, the current thread owns
+static thread_local JobSystem *t_system = nullptr;
+static thread_local size_t t_index = 0;
+
+void JobCounter::add() {
+    std::lock_guard lock{m_mutex};
+    m_count++;
+}
+
+void JobCounter::finish(JobSystem &system, std::exception_ptr error) {
+    std::vector<Job *> ready;
+    {
+        std::lock_guard lock{m_mutex};
+        if (error && !m_error) {
+            m_error = error;
+        }
+        if (--m_count == 0) {
+            ready.swap(m_continuations);
+        }
+    }
+    // The counter may be destroyed as soon as the lock is released, so
+    // only touch the jobs we took from it
+    for (auto *job : ready) {
+        system.submit(job);
+    }
+}
+
+bool JobCounter::done() {
+    std::lock_guard lock{m_mutex};
+    return m_count == 0;
+}
+
+bool JobDeque::push(Job *job) {
+    const auto bottom = m_bottom.load(std::memory_order_relaxed);
+    const auto top = m_top.load(std::memory_order_acquire);
+    if (bottom - top >= (int64_t)JOB_DEQUE_CAPACITY) {
+        return false;
+    }
+    m_buffer[bottom & (JOB_DEQUE_CAPACITY - 1)].store(
+        job, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_bottom.store(bottom + 1, std::memory_order_relaxed);
+    return true;
+}
+
+Job *JobDeque::pop() {
+    const auto bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+    m_bottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto top = m_top.load(std::memory_order_relaxed);
+    if (top > bottom) {
+        // Empty
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    auto *job = m_buffer[bottom & (JOB_DEQUE_CAPACITY - 1)].load(
+        std::memory_order_relaxed);
+    if (top == bottom) {
+        // Last job; race thieves for it
+        if (!m_top.compare_exchange_strong(top, top + 1,
+                                           std::memory_order_seq_cst,
+                                           std::memory_order_relaxed)) {
+            job = nullptr;
+        }
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return job;
+}
+
+Job *JobDeque::steal() {
+    auto top = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const auto bottom = m_bottom.load(std::memory_order_acquire);
+    if (top >= bottom) {
+        return nullptr;
+    }
+    auto *job = m_buffer[top & (JOB_DEQUE_CAPACITY - 1)].load(
+        std::memory_order_relaxed);
+    if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                       std::memory_order_relaxed)) {
+        // Lost to the owner or another thief
+        return nullptr;
+    }
+    return job;
+}
+
+JobSystem::JobSystem(size_t worker_count) {
+    for (size_t i = 0; i <= worker_count; i++) {
+        m_deques.push_back(std::make_unique<JobDeque>());
+    }
+    t_system = this;
+    t_index = 0;
+    for (size_t i = 1; i <= worker_count; i++) {
+        m_workers.emplace_back([this, i]() { work(i); });
+    }
+}
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard lock{m_mutex};
+        m_stopping = true;
+    }
+    m_condition.notify_all();
+    for (auto &worker : m_workers) {
+        worker.join();
+    }
+    for (size_t i = 0; i < m_deques.size(); i++) {
+        while (auto *job = m_deques[i]->steal()) {
+            delete job;
+        }
+    }
+    for (auto *job : m_injected) {
+        delete job;
+    }
+    if (t_system == this) {
+        t_system = nullptr;
+    }
+}
+
+bool JobSystem::on_main_thread() const {
+    return t_system == this && t_index == 0;
+}
+
+void JobSystem::submit(Job *job) {
+    m_queued++;
+    if (t_system != this || !m_deques[t_index]->push(job)) {
+        std::lock_guard lock{m_mutex};
+        m_injected.push_back(job);
+    }
+    // Taking the lock orders this with a worker checking m_queued
+    // before it sleeps, so the wakeup can't be lost
+    { std::lock_guard lock{m_mutex}; }
+    m_condition.notify_one();
+}
+
+Job *JobSystem::take() {
+    // Threads without a deque of their own can still steal
+    const bool owner = t_system == this;
+    const size_t index = owner ? t_index : 0;
+    Job *job = owner ? m_deques[index]->pop() : nullptr;
+    // Steal round-robin starting from the next thread over so thieves
+    // spread out
+    for (size_t i = owner; !job && i < m_deques.size(); i++) {
+        job = m_deques[(index + i) % m_deques.size()]->steal();
+    }
+    if (!job) {
+        std::lock_guard lock{m_mutex};
+        if (!m_injected.empty()) {
+            job = m_injected.front();
+            m_injected.pop_front();
+        }
+    }
+    if (job) {
+        m_queued--;
+    }
+    return job;
+}
+
+void JobSystem::execute(Job *job) {
+    std::exception_ptr error;
+    try {
+        job->function();
+    } catch (...) {
+        error = std::current_exception();
+    }
+    auto *counter = job->counter;
+    delete job;
+    counter->finish(*this, error);
+}
+
+void JobSystem::work(size_t index) {
+    t_system = this;
+    t_index = index;
+    while (true) {
+        if (auto *job = take()) {
+            execute(job);
+            continue;
+        }
+        std::unique_lock lock{m_mutex};
+        m_condition.wait(lock, [this]() { return m_stopping || m_queued; });
+        if (m_stopping) {
+            return;
+        }
+    }
+}
+
+void JobSystem::run(std::function<void()> function, JobCounter &counter,
+                    JobCounter *after) {
+    counter.add();
+    auto *job = new Job{std::move(function), &counter};
+    if (after) {
+        std::lock_guard lock{after->m_mutex};
+        if (after->m_count > 0) {
+            after->m_continuations.push_back(job);
+            return;
+        }
+    }
+    submit(job);
+}
+
+void JobSystem::wait(JobCounter &counter) {
+    while (!counter.done()) {
+        if (on_main_thread()) {
+            run_main_tasks();
+        }
+        if (auto *job = take()) {
+            execute(job);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    std::lock_guard lock{counter.m_mutex};
+    if (counter.m_error) {
+        std::rethrow_exception(std::exchange(counter.m_error, nullptr));
+    }
+}
+
+void JobSystem::run_on_main(std::function<void()> function) {
+    std::lock_guard lock{m_main_mutex};
+    m_main_tasks.push_back(std::move(function));
+}
+
+void JobSystem::run_main_tasks() {
+    assert(on_main_thread());
+    std::vector<std::function<void()>> tasks;
+    {
+        std::lock_guard lock{m_main_mutex};
+        tasks.swap(m_main_tasks);
+    }
+    for (const auto &task : tasks) {
+        task();
+    }
+}
@@ -0,0 +1,150 @@
+#ifndef JOBS_H_INCLUDED
+#define JOBS_H_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Must be a power of two
+const size_t JOB_DEQUE_CAPACITY = 4096;
+
+class JobSystem;
+
+struct Job {
+    std::function<void()> function;
+    class JobCounter *counter;
+};
+
+/// @brief Tracks a group of jobs. Waiting on a counter runs other jobs
+/// until every job in the group has finished, and jobs can be made to
+/// start only once a counter has finished.
+class JobCounter {
+    std::mutex m_mutex;
+    size_t m_count = 0;
+    std::exception_ptr m_error;
+    // Jobs waiting for this counter to finish
+    std::vector<Job *> m_continuations;
+
+    friend class JobSystem;
+
+    void add();
+    void finish(JobSystem &system, std::exception_ptr error);
+
+public:
+    JobCounter() = default;
+    JobCounter(const JobCounter &other) = delete;
+    JobCounter &operator=(const JobCounter &other) = delete;
+
+    bool done();
+};
+
+/// @brief Chase-Lev work-stealing deque of fixed capacity. Only the
+/// owning thread may push and pop; any thread may steal.
+class JobDeque {
+    std::atomic<int64_t> m_top = 0;
+    std::atomic<int64_t> m_bottom = 0;
+    std::unique_ptr<std::atomic<Job *>[]> m_buffer;
+
+public:
+    JobDeque() : m_buffer{new std::atomic<Job *>[JOB_DEQUE_CAPACITY]} {}
+
+    /// @brief Returns false if the deque is full.
+    bool push(Job *job);
+    /// @brief Takes the most recently pushed job.
+    Job *pop();
+    /// @brief Takes the least recently pushed job.
+    Job *steal();
+};
+
+/// @brief Work-stealing thread pool for short CPU-bound jobs.
+///
+/// Every worker and the thread that created the system own a deque.
+/// Jobs submitted from one of those threads go to its own deque; idle
+/// threads steal from the others. Jobs submitted from any other thread
+/// go through a shared queue. Blocking I/O doesn't belong here; see
+/// AsyncAssetLoader.
+class JobSystem {
+    // Index 0 belongs to the thread that created the system
+    std::vector<std::unique_ptr<JobDeque>> m_deques;
+    std::vector<std::thread> m_workers;
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::deque<Job *> m_injected;
+    std::atomic<size_t> m_queued = 0;
+    bool m_stopping = false;
+
+    std::mutex m_main_mutex;
+    std::vector<std::function<void()>> m_main_tasks;
+
+    friend class JobCounter;
+
+    void submit(Job *job);
+    Job *take();
+    void execute(Job *job);
+    void work(size_t index);
+    bool on_main_thread() const;
+
+public:
+    /// @brief Defaults to one worker per core besides the calling
+    /// thread.
+    JobSystem(size_t worker_count = default_worker_count());
+    JobSystem(const JobSystem &other) = delete;
+    JobSystem &operator=(const JobSystem &other) = delete;
+    /// Jobs still queued are dropped without running.
+    ~JobSystem();
+
+    static size_t default_worker_count() {
+        return std::max(std::thread::hardware_concurrency(), 1u) - 1;
+    }
+
+    /// @brief Number of threads running jobs, including the main one.
+    size_t thread_count() const { return m_deques.size(); }
+
+    /// @brief Queues `function` as part of `counter`. If `after` is
+    /// given, the job only starts once it has finished.
+    void run(std::function<void()> function, JobCounter &counter,
+             JobCounter *after = nullptr);
+    /// @brief Runs jobs until `counter` has finished, then rethrows the
+    /// first exception any of its jobs threw. Can be called from any
+    /// thread, including from inside a job.
+    void wait(JobCounter &counter);
+
+    /// @brief Runs `f(i)` for every i in [0, count), `grain` indices per
+    /// job. A grain of 0 picks one giving each thread a few jobs.
+    template<typename F>
+    void parallel_for(size_t count, F f, size_t grain = 0) {
+        if (!grain) {
+            grain = std::max<size_t>(count / (4 * thread_count()), 1);
+        }
+        JobCounter counter;
+        for (size_t begin = 0; begin < count; begin += grain) {
+            const size_t end = std::min(begin + grain, count);
+            run(
+                [&f, begin, end]() {
+                    for (size_t i = begin; i < end; i++) {
+                        f(i);
+                    }
+                },
+                counter);
+        }
+        wait(counter);
+    }
+
+    /// @brief Queues `function` to run on the main thread, the one that
+    /// created the system, during its next run_main_tasks() or wait().
+    /// For work that must not leave that thread, e.g. queue submission.
+    void run_on_main(std::function<void()> function);
+    /// @brief Runs queued main-thread tasks. Main thread only.
+    void run_main_tasks();
+};
+
+#endif
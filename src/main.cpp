@@ -1,18 +1,32 @@
 #include "main.h"
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <numbers>
+#include <string>
+#include <vector>
 
 #include <SDL2/SDL.h>
+#include <SDL2/SDL_vulkan.h>
 
 #include "asset.h"
+#include "asset_loader.h"
 #include "camera.h"
 #include "config.h"
 #include "exceptions.h"
+#include "jobs.h"
 #include "math/aabb.h"
 #include "math/scene.h"
 #include "math/vector.h"
 #include "mesh_builder.h"
+#include "render_thread.h"
 #include "vulkan/device.h"
 #include "vulkan/renderer.h"
 
@@ -20,6 +34,68 @@ std::string get_asset_root() {
     return std::getenv("ASSET_PATH");
 }
 
+// Defaults to the XDG cache directory. An empty path means pipelines
+// aren't cached between runs.
+std::string get_pipeline_cache_path() {
+    if (const char *path = std::getenv("ENGY_PIPELINE_CACHE")) {
+        return path;
+    }
+    std::filesystem::path dir;
+    if (const char *cache_home = std::getenv("XDG_CACHE_HOME")) {
+        dir = cache_home;
+    } else if (const char *home = std::getenv("HOME")) {
+        dir = std::filesystem::path{home} / ".cache";
+    } else {
+        return {};
+    }
+    return (dir / "engy" / "pipelines.bin").string();
+}
+
+// ENGY_PRESENT_MODE trades latency for tearing and power: "fifo" (the
+// default) waits for vblank, "mailbox" replaces queued frames and
+// "immediate" presents straight away.
+vk::PresentModeKHR get_present_mode() {
+    const char *value = std::getenv("ENGY_PRESENT_MODE");
+    if (!value || !strcmp(value, "fifo")) {
+        return vk::PresentModeKHR::eFifo;
+    } else if (!strcmp(value, "fifo_relaxed")) {
+        return vk::PresentModeKHR::eFifoRelaxed;
+    } else if (!strcmp(value, "mailbox")) {
+        return vk::PresentModeKHR::eMailbox;
+    } else if (!strcmp(value, "immediate")) {
+        return vk::PresentModeKHR::eImmediate;
+    }
+    throw SystemException(std::string{"Invalid ENGY_PRESENT_MODE: "} + value);
+}
+
+uint32_t get_frames_in_flight() {
+    const char *value = std::getenv("ENGY_FRAMES_IN_FLIGHT");
+    if (!value) {
+        return DEFAULT_FRAMES_IN_FLIGHT;
+    }
+    const auto count = strtoul(value, nullptr, 10);
+    if (count < 1 || count > MAX_FRAMES_IN_FLIGHT) {
+        throw SystemException(
+            std::string{"ENGY_FRAMES_IN_FLIGHT must be between 1 and "} +
+            std::to_string(MAX_FRAMES_IN_FLIGHT));
+    }
+    return count;
+}
+
+// ENGY_MAX_FPS caps how often frames are rendered. Unset or 0 leaves it
+// to the present mode.
+float get_max_fps() {
+    const char *value = std::getenv("ENGY_MAX_FPS");
+    if (!value) {
+        return 0;
+    }
+    const auto fps = strtof(value, nullptr);
+    if (!(fps >= 0)) {
+        throw SystemException(std::string{"Invalid ENGY_MAX_FPS: "} + value);
+    }
+    return fps;
+}
+
 void set_relative_mouse(bool enable) {
     if (SDL_SetRelativeMouseMode(enable ? SDL_TRUE : SDL_FALSE)) {
         throw SystemException("Failed to capture mouse");
@@ -72,8 +148,8 @@ void State::handle_event(const SDL_Event &event) {
     }
 }
 
-void State::ticker(const uint8_t *keystate) {
-    m_rig->ticker(keystate);
+void State::ticker(const uint8_t *keystate, float dt) {
+    m_rig->ticker(keystate, dt);
 }
 
 /// @brief Returns a view-space vector representing where the cursor is
@@ -94,11 +170,6 @@ Vector3 get_cursor_vector() {
     return vec3(vx, vy, 1).normalized();
 }
 
-Matrix4 get_projection() {
-    float aspect = static_cast<float>(WINDOW_WIDTH) / WINDOW_HEIGHT;
-    return scene::projection(FOVY, aspect, Z_NEAR, Z_FAR);
-}
-
 // clang-format off
 const std::array<float, 36> VERTICES = {
     -0.5, -0.5, 0.0, 0.0, 0.0, -1.0, 0.0, 0.0, 0.0,
@@ -112,91 +183,322 @@ const std::array<uint32_t, 6> INDICES = {
 };
 // clang-format on
 
-void main_loop(SDL_Window *window) {
-    auto resolver = std::unique_ptr<AssetResolver>(
-        new DirectoryAssetResolver(get_asset_root()));
-    AssetApi assets{std::move(resolver)};
-    // Renderer renderer{assets};
-
-    std::unique_ptr<FirstPersonCameraRig> rig{new FirstPersonCameraRig()};
-    State state{std::move(rig)};
-
-    auto device = VulkanDevice::create(window, 0, true);
-    auto swapchain = VulkanSwapchain::create(device, vk::SwapchainKHR{});
-    VulkanRenderer renderer{assets, std::move(device), std::move(swapchain)};
-    renderer.create_graphics_pipeline(assets);
+// Chunks that are meshed and drawn
+const int I_MIN = -1, I_MAX = 1;
+const int J_MIN = -1, J_MAX = 1;
+const int K_MIN = -1, K_MAX = 1;
+
+AssetApi create_assets() {
+    // ASSET_PATH may name either a directory or a packed archive
+    const auto asset_root = get_asset_root();
+    std::unique_ptr<AssetResolver> resolver;
+    if (std::filesystem::is_regular_file(asset_root)) {
+        resolver.reset(new ArchiveAssetResolver(asset_root));
+    } else {
+        resolver.reset(new DirectoryAssetResolver(std::string{asset_root}));
+    }
+    resolver.reset(new CachingAssetResolver(std::move(resolver)));
+    return AssetApi{std::move(resolver)};
+}
 
+/// @brief Generates the world's chunks and uploads their meshes. Blocks
+/// until the upload is done.
+void build_world(VulkanRenderer &renderer, AsyncAssetLoader &loader,
+                 JobSystem &jobs, ChunkMap &chunk_map) {
     BlockRegistry registry = BlockRegistry::create();
-    ChunkMap chunk_map;
-
-    const int I_MIN = -1, I_MAX = 1;
-    const int J_MIN = -1, J_MAX = 1;
-    const int K_MIN = -1, K_MAX = 1;
+    // Read the block textures off the disk while the chunks generate
+    renderer.textures().prefetch(BlockTextureTable::texture_paths(registry),
+                                 loader);
 
+    // Meshing a chunk reads its neighbors, so generate a border too
+    std::vector<ChunkPos> generated;
     for (int i = I_MIN - 1; i <= I_MAX + 1; i++) {
         for (int j = J_MIN - 1; j <= J_MAX + 1; j++) {
             for (int k = K_MIN - 1; k <= K_MAX + 1; k++) {
-                chunk_map.generate_chunk({i, j, k});
+                generated.push_back({i, j, k});
             }
         }
     }
+    chunk_map.generate_chunks(generated, jobs);
 
     renderer.staging().begin_staging();
+    const auto block_textures =
+        BlockTextureTable::create(registry, renderer.textures(), jobs);
     const auto mesh = renderer.create_mesh(
         {(const char *)VERTICES.data(), sizeof(float) * VERTICES.size()},
         INDICES);
+    std::vector<ChunkPos> meshed;
     for (int i = I_MIN; i <= I_MAX; i++) {
         for (int j = J_MIN; j <= J_MAX; j++) {
             for (int k = K_MIN; k <= K_MAX; k++) {
-                chunk_map.update_mesh(registry, renderer, {i, j, k});
+                meshed.push_back({i, j, k});
             }
         }
     }
+    chunk_map.update_meshes(registry, block_textures, renderer, meshed, jobs);
     renderer.staging().end_staging(renderer.device().graphics_queue());
     renderer.staging().wait();
+}
+
+/// @brief Appends a draw for every meshed chunk to `draws`.
+void collect_draws(const ChunkMap &chunk_map, std::vector<MeshDraw> &draws) {
+    for (int i = I_MIN; i <= I_MAX; i++) {
+        for (int j = J_MIN; j <= J_MAX; j++) {
+            for (int k = K_MIN; k <= K_MAX; k++) {
+                const auto &chunk = chunk_map.at({i, j, k});
+                if (!chunk.mesh()) {
+                    continue;
+                }
+                auto instance = Matrix4::identity();
+                instance[3] = chunk.pos().offset();
+                draws.push_back({chunk.mesh(), instance});
+            }
+        }
+    }
+}
+
+void save_pipeline_cache(VulkanRenderer &renderer) {
+    try {
+        renderer.save_pipeline_cache();
+    } catch (const SystemException &e) {
+        // Only costs startup time next run
+        std::cerr << "warning: " << e.what() << "\n";
+    }
+}
+
+void main_loop(SDL_Window *window) {
+    AssetApi assets = create_assets();
+    AsyncAssetLoader loader{assets};
+    JobSystem jobs;
+    // Renderer renderer{assets};
+
+    std::unique_ptr<FirstPersonCameraRig> rig{new FirstPersonCameraRig()};
+    State state{std::move(rig)};
+
+    // Only read here on the main thread, which is where SDL resizes the
+    // window, and handed to the render thread in snapshots
+    const auto get_drawable_extent = [window]() {
+        int w, h;
+        SDL_Vulkan_GetDrawableSize(window, &w, &h);
+        return vk::Extent2D(w, h);
+    };
+    auto drawable_extent = get_drawable_extent();
+
+    auto device = VulkanDevice::create(window, 0, true, get_present_mode());
+    auto swapchain =
+        VulkanSwapchain::create(device, vk::SwapchainKHR{}, drawable_extent);
+    VulkanRenderer renderer{assets, std::move(device), std::move(swapchain),
+                            get_pipeline_cache_path(), get_frames_in_flight()};
+    renderer.create_graphics_pipeline();
 
-    auto start = std::chrono::steady_clock::now();
-    while (1) {
+    ChunkMap chunk_map;
+    build_world(renderer, loader, jobs, chunk_map);
+
+    // Simulation and input run here; recording and presenting run on
+    // the render thread, which draws whatever was published last.
+    RenderThread render_thread{renderer, get_max_fps()};
+    uint64_t resize_count = 0;
+    // Bump whenever chunk meshes are added, removed or rebuilt so the
+    // render thread doesn't skip the frame
+    uint64_t scene_version = 0;
+
+    // Returns false once the window has been closed
+    const auto handle_events = [&]() {
+        bool running = true;
         SDL_Event event;
         while (SDL_PollEvent(&event)) {
             if (event.type == SDL_QUIT) {
-                goto finish;
+                running = false;
+            }
+            if (event.type == SDL_WINDOWEVENT &&
+                event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+                resize_count++;
+                drawable_extent = get_drawable_extent();
             }
             state.handle_event(event);
         }
+        return running;
+    };
+
+    typedef std::chrono::duration<float> Seconds;
+    const Seconds tick{1.0f / SIMULATION_HZ};
+    Seconds accumulator{0};
+
+    const auto publish = [&](std::chrono::steady_clock::time_point now) {
+        auto &snapshot = render_thread.snapshots().write();
+        snapshot.previous_camera = state.rig().interpolated_transform(0);
+        snapshot.camera = state.rig().interpolated_transform(1);
+        // The newest tick's state is current as of the time that hasn't
+        // been simulated yet
+        snapshot.tick_time =
+            now - std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      accumulator);
+        snapshot.resize_count = resize_count;
+        snapshot.drawable_extent = drawable_extent;
+        snapshot.scene_version = scene_version;
+        snapshot.focused = state.focused();
+        snapshot.draws.clear();
+        collect_draws(chunk_map, snapshot.draws);
+        render_thread.snapshots().publish();
+    };
+
+    // Simulation advances in fixed ticks. The render thread blends the
+    // last two simulated states by how far it is into the next tick.
+    auto previous = std::chrono::steady_clock::now();
+    publish(previous);
+    render_thread.start();
+    while (handle_events() && render_thread.running()) {
+        // Hand finished asset loads to their owners
+        loader.poll();
+
+        const auto now = std::chrono::steady_clock::now();
+        accumulator += now - previous;
+        previous = now;
+        accumulator =
+            std::min(accumulator, MAX_SIMULATION_TICKS_PER_FRAME * tick);
         const auto *keystate = SDL_GetKeyboardState(nullptr);
-        state.ticker(keystate);
-
-        try {
-            renderer.flush_frame();
-            renderer.acquire_image();
-        } catch (const TimeoutException &e) {
-            continue;
+        while (accumulator >= tick) {
+            state.ticker(keystate, tick.count());
+            accumulator -= tick;
+        }
+        // Published after every batch of input, not only after ticks, so
+        // mouse look reaches the render thread's late latch promptly
+        publish(now);
+
+        // Sleep until the next tick is due or more input arrives. In the
+        // background, ticks are batched up at the unfocused frame rate.
+        auto timeout =
+            std::chrono::ceil<std::chrono::milliseconds>(tick - accumulator);
+        if (!state.focused()) {
+            timeout = std::max(timeout, std::chrono::milliseconds{
+                                            int(1000 / UNFOCUSED_FPS)});
         }
+        SDL_WaitEventTimeout(nullptr, timeout.count());
+    }
+    render_thread.stop();
+
+    renderer.wait_idle();
+    save_pipeline_cache(renderer);
+}
+
+// World-space center of the meshed chunks
+const Vector3 WORLD_CENTER =
+    vec3(4 * (I_MIN + I_MAX + 1), 4 * (J_MIN + J_MAX + 1),
+         4 * (K_MIN + K_MAX + 1));
+
+/// @brief View matrix of a scripted camera `t` seconds into its path.
+Matrix4 camera_path_view(CameraPath path, float t) {
+    const float pi = std::numbers::pi;
+    switch (path) {
+    case CameraPath::Orbit: {
+        // One revolution every 10 seconds, slightly above the world
+        const float angle = t * (2 * pi / 10);
+        const auto pos =
+            WORLD_CENTER + vec3(40 * cosf(angle), -16, 40 * sinf(angle));
+        return scene::targeting_camera_xform(pos, WORLD_CENTER);
+    }
+    case CameraPath::Flythrough: {
+        // 10 units per second along a line 80 units long
+        const float x = fmodf(10 * t, 80) - 40;
+        const auto pos = WORLD_CENTER + vec3(x, 0, 0);
+        return scene::looking_camera_xform(pos, vec3(1, 0, 0));
+    }
+    }
+    abort();
+}
+
+void print_benchmark_report(std::vector<float> frame_ms, float total_ms) {
+    std::sort(frame_ms.begin(), frame_ms.end());
+    const auto percentile = [&](float p) {
+        return frame_ms[std::min<size_t>(p * frame_ms.size(),
+                                         frame_ms.size() - 1)];
+    };
+    float sum = 0;
+    for (const auto ms : frame_ms) {
+        sum += ms;
+    }
+    std::cout << frame_ms.size() << " frames in " << total_ms << " ms ("
+              << 1000 * frame_ms.size() / total_ms << " fps)\n";
+    std::cout << "frame ms\tmean\tp50\tp99\tmax\n";
+    std::cout << "\t\t" << sum / frame_ms.size() << "\t" << percentile(0.5)
+              << "\t" << percentile(0.99) << "\t" << frame_ms.back() << "\n";
+}
 
-        auto now = std::chrono::steady_clock::now();
-        std::chrono::duration<float> dt = now - start;
+/// @brief Renders a scripted camera path offscreen, without a window,
+/// and reports how long frames took.
+///
+/// The camera advances by one simulation tick per frame rather than by
+/// wall time, so every run renders exactly the same frames.
+void headless_loop(const HeadlessOptions &options) {
+    AssetApi assets = create_assets();
+    AsyncAssetLoader loader{assets};
+    JobSystem jobs;
+
+    const vk::Extent2D extent(options.width, options.height);
+    auto device = VulkanDevice::create_headless(0, options.debug, extent);
+    auto swapchain =
+        VulkanSwapchain::create(device, vk::SwapchainKHR{}, extent);
+    VulkanRenderer renderer{assets, std::move(device), std::move(swapchain),
+                            get_pipeline_cache_path(), get_frames_in_flight()};
+    const auto pipeline = renderer.create_graphics_pipeline();
 
+    ChunkMap chunk_map;
+    build_world(renderer, loader, jobs, chunk_map);
+    std::vector<MeshDraw> draws;
+    collect_draws(chunk_map, draws);
+    // Compiling isn't what's being measured
+    pipeline.wait();
+
+    const float aspect = static_cast<float>(options.width) / options.height;
+    const auto proj = scene::projection(FOVY, aspect, Z_NEAR, Z_FAR);
+    std::vector<float> frame_ms;
+    const auto start = std::chrono::steady_clock::now();
+    auto previous = start;
+    for (uint32_t frame = 0; frame < options.frames; frame++) {
+        renderer.flush_frame();
+        // Offscreen images are never out of date
+        renderer.acquire_image();
         renderer.begin_rendering();
-        auto proj = get_projection();
-        auto view = state.rig().reverse_transform();
-        ViewUniforms view_uniforms{proj, view};
-        renderer.update_uniforms(view_uniforms);
+        const float t = static_cast<float>(frame) / SIMULATION_HZ;
+        renderer.update_uniforms(
+            {proj, camera_path_view(options.camera_path, t)});
         renderer.begin_rendering_meshes();
-        for (int i = I_MIN; i <= I_MAX; i++) {
-            for (int j = J_MIN; j <= J_MAX; j++) {
-                for (int k = K_MIN; k <= K_MAX; k++) {
-                    const auto &chunk = chunk_map.at({i, j, k});
-                    renderer.render_chunk(chunk);
-                }
-            }
+        for (const auto &draw : draws) {
+            renderer.render_mesh(draw.mesh, draw.instance);
+        }
+        if (!options.dump_dir.empty()) {
+            renderer.request_readback();
         }
         renderer.end_rendering();
+        renderer.submit();
         renderer.present();
-    }
+        renderer.defragment_meshes();
+
+        if (!options.dump_dir.empty()) {
+            char name[32];
+            snprintf(name, sizeof(name), "frame_%05u.ppm", frame);
+            const auto path = std::filesystem::path{options.dump_dir} / name;
+            const auto bytes = renderer.read_back().save_ppm();
+            std::ofstream f(path, std::ios_base::binary);
+            f.write(bytes.data(), bytes.size());
+            if (!f.good()) {
+                throw SystemException("Cannot write file: " + path.string());
+            }
+        }
 
-finish:
+        const auto now = std::chrono::steady_clock::now();
+        frame_ms.push_back(
+            std::chrono::duration<float, std::milli>(now - previous).count());
+        previous = now;
+    }
     renderer.wait_idle();
+    const std::chrono::duration<float, std::milli> total =
+        std::chrono::steady_clock::now() - start;
+
+    if (!frame_ms.empty()) {
+        print_benchmark_report(std::move(frame_ms), total.count());
+    }
+    save_pipeline_cache(renderer);
 }
 
 int sdl_main() {
@@ -225,6 +527,55 @@ int sdl_main() {
     return 0;
 }
 
-int main() {
+static void usage(std::ostream &out = std::cerr) {
+    out << "usage: engy [--headless [--frames N] [--size WxH]\n"
+           "            [--camera orbit|flythrough] [--dump DIR]\n"
+           "            [--debug]]\n";
+}
+
+int main(int argc, char **argv) {
+    bool headless = false;
+    HeadlessOptions options;
+    for (int i = 1; i < argc; i++) {
+        const bool has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--help")) {
+            usage(std::cout);
+            return 0;
+        } else if (!strcmp(argv[i], "--headless")) {
+            headless = true;
+        } else if (!strcmp(argv[i], "--frames") && has_value) {
+            options.frames = strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--size") && has_value) {
+            const char *size = argv[++i];
+            if (sscanf(size, "%ux%u", &options.width, &options.height) != 2 ||
+                !options.width || !options.height) {
+                usage();
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--camera") && has_value) {
+            const char *path = argv[++i];
+            if (!strcmp(path, "orbit")) {
+                options.camera_path = CameraPath::Orbit;
+            } else if (!strcmp(path, "flythrough")) {
+                options.camera_path = CameraPath::Flythrough;
+            } else {
+                usage();
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--dump") && has_value) {
+            options.dump_dir = argv[++i];
+        } else if (!strcmp(argv[i], "--debug")) {
+            options.debug = true;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (headless) {
+        // No SDL at all, so this works without a display
+        headless_loop(options);
+        return 0;
+    }
     sdl_main();
-}
\ No newline at end of file
+}
@@ -1,11 +1,14 @@
 #ifndef MAIN_H_INCLUDED
 #define MAIN_H_INCLUDED
 
+#include <cstdint>
 #include <memory>
+#include <string>
 
 #include <SDL2/SDL.h>
 
 #include "camera.h"
+#include "config.h"
 
 class State {
     std::unique_ptr<CameraRig> m_rig;
@@ -19,10 +22,30 @@ public:
     const CameraRig &rig() const { return *m_rig; }
     bool &highlight() { return m_highlight; }
     const bool &highlight() const { return m_highlight; }
+    bool focused() const { return m_focused; }
     void set_focus(bool focused);
 
     void handle_event(const SDL_Event &event);
-    void ticker(const uint8_t *keystate);
+    void ticker(const uint8_t *keystate, float dt);
+};
+
+enum class CameraPath {
+    /// Circles the world looking at its center
+    Orbit,
+    /// Flies straight through the world along +x, over and over
+    Flythrough,
+};
+
+/// @brief Settings of a headless benchmark run, see `engy --help`.
+struct HeadlessOptions {
+    uint32_t frames = HEADLESS_FRAMES;
+    uint32_t width = WINDOW_WIDTH;
+    uint32_t height = WINDOW_HEIGHT;
+    CameraPath camera_path = CameraPath::Orbit;
+    /// Every frame is read back and written here as a PPM if not empty
+    std::string dump_dir;
+    /// Enables the validation layers, which skew frame times
+    bool debug = false;
 };
 
 #endif
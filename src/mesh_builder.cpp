@@ -4,7 +4,8 @@
 
 #include <algorithm>
 #include <cassert>
-#include <cstdlib>
+#include <iterator>
+#include <string>
 
 #include "mesh_builder.h"
 
@@ -50,6 +51,31 @@ Direction axis_to_dir_neg(Axis axis) {
     }
 }
 
+std::vector<std::string>
+BlockTextureTable::texture_paths(const BlockRegistry &registry) {
+    std::vector<std::string> paths;
+    for (const auto &[type, info] : registry.blocks()) {
+        paths.insert(paths.end(), std::begin(info.textures),
+                     std::end(info.textures));
+    }
+    return paths;
+}
+
+BlockTextureTable BlockTextureTable::create(const BlockRegistry &registry,
+                                            TextureMap &texture_map,
+                                            JobSystem &jobs) {
+    texture_map.preload(texture_paths(registry), jobs);
+
+    BlockTextureTable table;
+    for (const auto &[type, info] : registry.blocks()) {
+        auto &ids = table.m_textures[type];
+        for (int i = 0; i < 3; i++) {
+            ids[i] = texture_map.get(info.textures[i]);
+        }
+    }
+    return table;
+}
+
 void MeshData::add_face(const BlockFace &face) {
     uint32_t i0 = vertices.size();
     int i = face.i, j = face.j, k = face.k;
@@ -124,6 +150,20 @@ void MeshData::add_face(const BlockFace &face) {
     vertices.push_back(vs[3]);
 }
 
+// Meshes are built on several threads at once and must come out the
+// same every run, so texture rotations are hashed from the face's world
+// position rather than drawn from rand()
+static uint32_t hash_face(int x, int y, int z, Direction dir) {
+    uint32_t h = (uint32_t)x * 0x8da6b343u ^ (uint32_t)y * 0xd8163841u ^
+                 (uint32_t)z * 0xcb1ab31fu ^ (uint32_t)dir * 0x165667b1u;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h;
+}
+
 void ChunkMeshBuilder::add_face(const BlockInfo &info, int i, int j, int k,
                                 Direction dir) {
     BlockFace face;
@@ -141,10 +181,12 @@ void ChunkMeshBuilder::add_face(const BlockInfo &info, int i, int j, int k,
         index = 1;
     }
 
-    face.texture = m_texture_map.get(info.textures[index]);
+    face.texture = m_textures.get(info.type, index);
 
     if (info.rotate[index]) {
-        face.rotation = rand() % 4;
+        const auto hash = hash_face(8 * m_pos.i + i, 8 * m_pos.j + j,
+                                    8 * m_pos.k + k, dir);
+        face.rotation = hash % 4;
     }
 
     m_faces.push_back(face);
@@ -184,9 +226,10 @@ MeshData ChunkMeshBuilder::build() {
     return data;
 };
 
-auto generate_mesh(const BlockRegistry &block_registry, TextureMap &texture_map,
-                   const ChunkMap &map, ChunkPos pos) -> MeshData {
-    ChunkMeshBuilder builder{block_registry, texture_map};
+auto generate_mesh(const BlockRegistry &block_registry,
+                   const BlockTextureTable &textures, const ChunkMap &map,
+                   ChunkPos pos) -> MeshData {
+    ChunkMeshBuilder builder{block_registry, textures, pos};
     const Chunk *chunks[4] = {
         &map.at(pos),
         &map.at({pos.i - 1, pos.j, pos.k}),
@@ -2,6 +2,7 @@
 #define MESH_BUILDER_H_INCLUDED
 
 #include <array>
+#include <unordered_map>
 #include <vector>
 
 #include "block.h"
@@ -48,14 +49,37 @@ struct MeshData {
     void add_face(const BlockFace &face);
 };
 
+/// @brief Texture ids of every block face, resolved up front so that
+/// meshing never has to load a texture.
+class BlockTextureTable {
+    std::unordered_map<BlockType, std::array<uint32_t, 3>> m_textures;
+
+public:
+    /// @brief Paths of every texture used by the registry, for
+    /// TextureMap::prefetch.
+    static std::vector<std::string>
+    texture_paths(const BlockRegistry &registry);
+    /// @brief Preloads every texture used by the registry. Must be
+    /// called while staging.
+    static BlockTextureTable create(const BlockRegistry &registry,
+                                    TextureMap &texture_map, JobSystem &jobs);
+
+    /// @brief Index is 0, 1 or 2 for top, middle and bottom.
+    uint32_t get(BlockType type, int index) const {
+        return m_textures.at(type)[index];
+    }
+};
+
 class ChunkMeshBuilder {
     const BlockRegistry &m_block_registry;
-    TextureMap &m_texture_map;
+    const BlockTextureTable &m_textures;
+    ChunkPos m_pos;
     std::vector<BlockFace> m_faces;
 
 public:
-    ChunkMeshBuilder(const BlockRegistry &registry, TextureMap &texture_map)
-        : m_block_registry{registry}, m_texture_map{texture_map} {}
+    ChunkMeshBuilder(const BlockRegistry &registry,
+                     const BlockTextureTable &textures, ChunkPos pos)
+        : m_block_registry{registry}, m_textures{textures}, m_pos{pos} {}
 
     void add_face(const BlockInfo &info, int i, int j, int k, Direction dir);
     // Neighbor is the adjacent block in the negative x, y, or z direction.
@@ -64,7 +88,8 @@ public:
     MeshData build();
 };
 
-auto generate_mesh(const BlockRegistry &block_registry, TextureMap &texture_map,
-                   const ChunkMap &map, ChunkPos pos) -> MeshData;
+auto generate_mesh(const BlockRegistry &block_registry,
+                   const BlockTextureTable &textures, const ChunkMap &map,
+                   ChunkPos pos) -> MeshData;
 
 #endif
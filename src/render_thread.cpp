@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "config.h"
+#include "math/scene.h"
+#include "render_thread.h"
+
+void SnapshotBuffer::publish() {
+    std::lock_guard lock{m_mutex};
+    std::swap(m_write, m_ready);
+    m_fresh = true;
+    m_condition.notify_all();
+}
+
+const SceneSnapshot &SnapshotBuffer::read() {
+    std::lock_guard lock{m_mutex};
+    if (m_fresh) {
+        std::swap(m_read, m_ready);
+        m_fresh = false;
+    }
+    return m_snapshots[m_read];
+}
+
+void SnapshotBuffer::wait(std::chrono::milliseconds timeout) {
+    std::unique_lock lock{m_mutex};
+    m_condition.wait_for(lock, timeout,
+                         [this]() { return m_fresh || m_stopping; });
+}
+
+void SnapshotBuffer::set_stopping(bool stopping) {
+    std::lock_guard lock{m_mutex};
+    m_stopping = stopping;
+    m_condition.notify_all();
+}
+
+// Blends the snapshot's camera by how far `now` is into the next tick
+static Matrix4 view_at(const SceneSnapshot &snapshot,
+                       std::chrono::steady_clock::time_point now) {
+    const std::chrono::duration<float> tick{1.0f / SIMULATION_HZ};
+    const std::chrono::duration<float> elapsed = now - snapshot.tick_time;
+    const float alpha = std::clamp(elapsed / tick, 0.0f, 1.0f);
+    const auto camera =
+        (1 - alpha) * snapshot.previous_camera + alpha * snapshot.camera;
+    return camera.rigid_inverse();
+}
+
+void RenderThread::start() {
+    m_stopping = false;
+    m_snapshots.set_stopping(false);
+    m_running = true;
+    m_thread = std::thread{[this]() { run(); }};
+}
+
+RenderThread::~RenderThread() {
+    m_stopping = true;
+    m_snapshots.set_stopping(true);
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void RenderThread::stop() {
+    m_stopping = true;
+    m_snapshots.set_stopping(true);
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    if (m_error) {
+        std::rethrow_exception(std::exchange(m_error, nullptr));
+    }
+}
+
+void RenderThread::run() {
+    const std::chrono::milliseconds idle_wait{IDLE_WAIT_MS};
+    try {
+        while (!m_stopping) {
+            const auto &snapshot = m_snapshots.read();
+            if (!needs_frame(snapshot)) {
+                m_snapshots.wait(idle_wait);
+                continue;
+            }
+            m_limiter.wait(snapshot.focused ? m_max_fps : UNFOCUSED_FPS);
+            if (!render_frame()) {
+                // Nothing to present to, e.g. while minimized
+                m_snapshots.wait(idle_wait);
+            }
+        }
+    } catch (...) {
+        m_error = std::current_exception();
+    }
+    m_running = false;
+}
+
+bool RenderThread::needs_frame(const SceneSnapshot &snapshot) {
+    // Until the pipeline is ready frames come out blank, so keep going
+    if (!m_rendered || !m_renderer.drew_meshes() ||
+        m_renderer.swapchain().out_of_date() ||
+        snapshot.resize_count != m_resize_count ||
+        snapshot.scene_version != m_scene_version) {
+        return true;
+    }
+    const auto view = view_at(snapshot, std::chrono::steady_clock::now());
+    return memcmp(&view, &m_view, sizeof(Matrix4)) != 0;
+}
+
+bool RenderThread::render_frame() {
+    auto &renderer = m_renderer;
+    const auto *snapshot = &m_snapshots.read();
+    if (snapshot->resize_count != m_resize_count) {
+        m_resize_count = snapshot->resize_count;
+        renderer.resize(snapshot->drawable_extent);
+    }
+
+    renderer.flush_frame();
+    if (!renderer.acquire_image()) {
+        return false;
+    }
+
+    renderer.begin_rendering();
+    const float aspect = static_cast<float>(renderer.swapchain().width()) /
+                         renderer.swapchain().height();
+    const auto proj = scene::projection(FOVY, aspect, Z_NEAR, Z_FAR);
+    const auto now = std::chrono::steady_clock::now();
+    renderer.update_uniforms({proj, view_at(*snapshot, now)});
+    renderer.begin_rendering_meshes();
+    for (const auto &draw : snapshot->draws) {
+        renderer.render_mesh(draw.mesh, draw.instance);
+    }
+    renderer.end_rendering();
+
+    // Late latch: mouse look published while waiting for the frame and
+    // recording it still makes it into this frame
+    const auto scene_version = snapshot->scene_version;
+    snapshot = &m_snapshots.read();
+    const auto view = view_at(*snapshot, std::chrono::steady_clock::now());
+    renderer.latch_view(view);
+    renderer.submit();
+    renderer.present();
+    renderer.defragment_meshes();
+
+    m_rendered = true;
+    m_view = view;
+    m_scene_version = scene_version;
+    return true;
+}
@@ -0,0 +1,119 @@
+#ifndef RENDER_THREAD_H_INCLUDED
+#define RENDER_THREAD_H_INCLUDED
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "frame_limiter.h"
+#include "math/matrix.h"
+#include "vulkan/mesh.h"
+#include "vulkan/renderer.h"
+
+struct MeshDraw {
+    Mesh mesh;
+    Matrix4 instance;
+};
+
+/// @brief Everything the render thread needs to draw a frame. Written by
+/// the main thread and never modified once published.
+struct SceneSnapshot {
+    /// Camera transforms before and after the newest tick. Only their
+    /// translations are blended, so their rotations should match.
+    Matrix4 previous_camera;
+    Matrix4 camera;
+    /// When the newest tick's state is current
+    std::chrono::steady_clock::time_point tick_time;
+    std::vector<MeshDraw> draws;
+    /// Bumped whenever `draws` changes other than through the camera
+    uint64_t scene_version = 0;
+    /// Bumped whenever the window is resized
+    uint64_t resize_count = 0;
+    /// Size of the window in pixels as of the last resize
+    vk::Extent2D drawable_extent;
+    bool focused = true;
+};
+
+/// @brief Triple buffer of snapshots. The writer never waits for the
+/// reader and the reader always gets the newest complete snapshot.
+class SnapshotBuffer {
+    std::array<SceneSnapshot, 3> m_snapshots;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    int m_write = 0;
+    int m_ready = 1;
+    int m_read = 2;
+    bool m_fresh = false;
+    bool m_stopping = false;
+
+public:
+    /// @brief The snapshot being written. Holds stale data from an
+    /// earlier publish, so overwrite all of it.
+    SceneSnapshot &write() { return m_snapshots[m_write]; }
+    void publish();
+    /// @brief Returns the newest published snapshot. It stays valid
+    /// until the next call.
+    const SceneSnapshot &read();
+    /// @brief Blocks until a snapshot newer than the last one read is
+    /// published, `timeout` passes or the reader is stopping.
+    void wait(std::chrono::milliseconds timeout);
+    /// @brief While `stopping` is set, wait() returns immediately. Wakes
+    /// a reader that is already waiting.
+    void set_stopping(bool stopping);
+};
+
+/// @brief Records and presents frames on a dedicated thread, drawing
+/// from snapshots published by the main thread.
+///
+/// Frames are only rendered when something visible changed, at most
+/// `max_fps` times a second, or UNFOCUSED_FPS while the window is in the
+/// background.
+///
+/// Once started, the renderer belongs to the render thread until stop()
+/// returns; the main thread must not touch it in between.
+class RenderThread {
+    VulkanRenderer &m_renderer;
+    float m_max_fps;
+    SnapshotBuffer m_snapshots;
+    FrameLimiter m_limiter;
+    std::atomic<bool> m_stopping = false;
+    std::atomic<bool> m_running = false;
+    std::exception_ptr m_error;
+    std::thread m_thread;
+
+    // What the last frame showed
+    bool m_rendered = false;
+    Matrix4 m_view;
+    uint64_t m_scene_version = 0;
+    uint64_t m_resize_count = 0;
+
+    void run();
+    bool needs_frame(const SceneSnapshot &snapshot);
+    bool render_frame();
+
+public:
+    /// A `max_fps` of 0 renders as fast as the present mode allows.
+    RenderThread(VulkanRenderer &renderer, float max_fps = 0)
+        : m_renderer{renderer}, m_max_fps{max_fps} {}
+    RenderThread(const RenderThread &other) = delete;
+    RenderThread &operator=(const RenderThread &other) = delete;
+    /// Errors are dropped; call stop() first to see them.
+    ~RenderThread();
+
+    SnapshotBuffer &snapshots() { return m_snapshots; }
+
+    /// @brief Publish a snapshot before starting.
+    void start();
+    /// @brief False once stopped or if rendering failed.
+    bool running() const { return m_running; }
+    /// @brief Waits for the frame being recorded to be submitted, then
+    /// rethrows whatever error stopped the thread, if any.
+    void stop();
+};
+
+#endif
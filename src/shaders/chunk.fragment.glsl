@@ -12,7 +12,12 @@ layout (location = 2) flat in uint in_texture;
 layout (location = 0) out vec4 out_color;
 
 void main() {
-    vec4 albedo = texture(u_samplers[in_texture], in_texcoord);
+    uint array = in_texture >> 16;
+    float layer = float(in_texture & 0xffff);
+    // Textures of different sizes live in different arrays, so a draw
+    // can mix arrays
+    vec4 albedo =
+        texture(u_textures[nonuniformEXT(array)], vec3(in_texcoord, layer));
     float darkness = 0.5 - 0.5 * in_normal.z;
     vec3 color = darkness * albedo.xyz;
     out_color = vec4(color, 1);
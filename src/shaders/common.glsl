@@ -1,7 +1,12 @@
-layout(set = 0, binding = 0) uniform sampler2D u_samplers[];
+// Texture ids index the array in the high 16 bits and the layer in the
+// low 16 bits
+layout(set = 0, binding = 0) uniform sampler2DArray u_textures[];
 
 layout(set = 1, binding = 0) uniform ViewUniforms {
     mat4 u_projection;
     mat4 u_view;
+};
+
+layout(set = 1, binding = 1) uniform InstanceUniforms {
     mat4 u_instance[512];
 };
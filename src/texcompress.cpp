@@ -0,0 +1,482 @@
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "exceptions.h"
+#include "image.h"
+#include "texcompress.h"
+
+// Finds the line through a block's pixels that best fits them, using
+// the first `N` channels, and returns its two ends clamped to [0, 255].
+template<int N>
+static void fit_endpoints(const uint8_t pixels[64], float e0[4], float e1[4]) {
+    float mean[N] = {};
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < N; c++) {
+            mean[c] += pixels[4 * i + c];
+        }
+    }
+    for (int c = 0; c < N; c++) {
+        mean[c] /= 16;
+    }
+
+    float cov[N][N] = {};
+    for (int i = 0; i < 16; i++) {
+        float d[N];
+        for (int c = 0; c < N; c++) {
+            d[c] = pixels[4 * i + c] - mean[c];
+        }
+        for (int r = 0; r < N; r++) {
+            for (int c = 0; c < N; c++) {
+                cov[r][c] += d[r] * d[c];
+            }
+        }
+    }
+
+    // Power iteration for the principal axis
+    float axis[N];
+    for (int c = 0; c < N; c++) {
+        axis[c] = 1;
+    }
+    for (int iter = 0; iter < 8; iter++) {
+        float next[N] = {};
+        for (int r = 0; r < N; r++) {
+            for (int c = 0; c < N; c++) {
+                next[r] += cov[r][c] * axis[c];
+            }
+        }
+        float norm = 0;
+        for (int c = 0; c < N; c++) {
+            norm = std::max(norm, std::abs(next[c]));
+        }
+        if (norm == 0) {
+            break;
+        }
+        for (int c = 0; c < N; c++) {
+            axis[c] = next[c] / norm;
+        }
+    }
+    float length2 = 0;
+    for (int c = 0; c < N; c++) {
+        length2 += axis[c] * axis[c];
+    }
+
+    float t_min = 0, t_max = 0;
+    for (int i = 0; i < 16; i++) {
+        float t = 0;
+        for (int c = 0; c < N; c++) {
+            t += (pixels[4 * i + c] - mean[c]) * axis[c];
+        }
+        t_min = std::min(t_min, t);
+        t_max = std::max(t_max, t);
+    }
+    if (length2 > 0) {
+        t_min /= length2;
+        t_max /= length2;
+    }
+    for (int c = 0; c < N; c++) {
+        e0[c] = std::clamp(mean[c] + t_min * axis[c], 0.0f, 255.0f);
+        e1[c] = std::clamp(mean[c] + t_max * axis[c], 0.0f, 255.0f);
+    }
+}
+
+template<int N>
+static int distance2(const uint8_t *pixel, const int color[4]) {
+    int sum = 0;
+    for (int c = 0; c < N; c++) {
+        const int d = pixel[c] - color[c];
+        sum += d * d;
+    }
+    return sum;
+}
+
+static uint16_t pack_565(const float color[4]) {
+    const auto r = (uint16_t)std::lround(color[0] * 31 / 255);
+    const auto g = (uint16_t)std::lround(color[1] * 63 / 255);
+    const auto b = (uint16_t)std::lround(color[2] * 31 / 255);
+    return (r << 11) | (g << 5) | b;
+}
+
+static void unpack_565(uint16_t packed, int color[4]) {
+    const int r = (packed >> 11) & 0x1f;
+    const int g = (packed >> 5) & 0x3f;
+    const int b = packed & 0x1f;
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+    color[3] = 255;
+}
+
+static void write_u16(uint8_t *out, uint16_t value) {
+    out[0] = value & 0xff;
+    out[1] = value >> 8;
+}
+
+// Encodes the color half of a BC1, BC2 or BC3 block. In three-color
+// mode, pixels with alpha below 128 use the transparent index.
+static void encode_color_block(const uint8_t pixels[64], uint8_t out[8],
+                               bool three_color) {
+    float e0[4], e1[4];
+    fit_endpoints<3>(pixels, e0, e1);
+    uint16_t c0 = pack_565(e1);
+    uint16_t c1 = pack_565(e0);
+    // Four-color mode is signalled by c0 > c1, three-color by c0 <= c1
+    if (three_color ? c0 > c1 : c0 < c1) {
+        std::swap(c0, c1);
+    }
+
+    int palette[4][4];
+    unpack_565(c0, palette[0]);
+    unpack_565(c1, palette[1]);
+    for (int c = 0; c < 3; c++) {
+        if (three_color) {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+            palette[3][c] = 0;
+        } else {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+    }
+    const int colors = three_color ? 3 : 4;
+
+    uint32_t indices = 0;
+    if (c0 != c1 || three_color) {
+        for (int i = 0; i < 16; i++) {
+            const uint8_t *pixel = &pixels[4 * i];
+            uint32_t best = 0;
+            if (three_color && pixel[3] < 128) {
+                best = 3;
+            } else {
+                int best_distance = distance2<3>(pixel, palette[0]);
+                for (int j = 1; j < colors; j++) {
+                    const int d = distance2<3>(pixel, palette[j]);
+                    if (d < best_distance) {
+                        best_distance = d;
+                        best = j;
+                    }
+                }
+            }
+            indices |= best << (2 * i);
+        }
+    }
+
+    write_u16(out, c0);
+    write_u16(out + 2, c1);
+    for (int i = 0; i < 4; i++) {
+        out[4 + i] = (indices >> (8 * i)) & 0xff;
+    }
+}
+
+void encode_bc1_block(const uint8_t pixels[64], uint8_t out[8]) {
+    bool transparent = false;
+    for (int i = 0; i < 16; i++) {
+        transparent |= pixels[4 * i + 3] < 128;
+    }
+    encode_color_block(pixels, out, transparent);
+}
+
+// Encodes the alpha half of a BC3 block, i.e. a BC4 block
+static void encode_alpha_block(const uint8_t pixels[64], uint8_t out[8]) {
+    uint8_t a0 = 0, a1 = 255;
+    for (int i = 0; i < 16; i++) {
+        a0 = std::max(a0, pixels[4 * i + 3]);
+        a1 = std::min(a1, pixels[4 * i + 3]);
+    }
+
+    // a0 > a1 selects the mode with six interpolated values
+    int palette[8];
+    palette[0] = a0;
+    palette[1] = a1;
+    for (int i = 1; i < 7; i++) {
+        palette[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+    }
+
+    uint64_t indices = 0;
+    if (a0 != a1) {
+        for (int i = 0; i < 16; i++) {
+            const int alpha = pixels[4 * i + 3];
+            uint64_t best = 0;
+            int best_distance = 256;
+            for (int j = 0; j < 8; j++) {
+                const int d = std::abs(alpha - palette[j]);
+                if (d < best_distance) {
+                    best_distance = d;
+                    best = j;
+                }
+            }
+            indices |= best << (3 * i);
+        }
+    }
+
+    out[0] = a0;
+    out[1] = a1;
+    for (int i = 0; i < 6; i++) {
+        out[2 + i] = (indices >> (8 * i)) & 0xff;
+    }
+}
+
+void encode_bc3_block(const uint8_t pixels[64], uint8_t out[16]) {
+    encode_alpha_block(pixels, out);
+    encode_color_block(pixels, out + 8, false);
+}
+
+// Writes fields into a 128-bit block, least significant bit first
+struct BitWriter {
+    uint8_t *out;
+    int pos = 0;
+
+    void write(uint32_t value, int bits) {
+        for (int i = 0; i < bits; i++) {
+            if (value & (1 << i)) {
+                out[pos >> 3] |= 1 << (pos & 7);
+            }
+            pos++;
+        }
+    }
+};
+
+const int BC7_WEIGHTS_4[16] = {0,  4,  9,  13, 17, 21, 26, 30,
+                               34, 38, 43, 47, 51, 55, 60, 64};
+
+// Quantizes an endpoint to 7 bits per channel plus a shared p-bit,
+// picking whichever p-bit reproduces the endpoint more closely
+static void quantize_bc7_endpoint(const float endpoint[4], uint8_t q[4],
+                                  uint8_t &p_bit, int color[4]) {
+    int best_error = INT32_MAX;
+    for (int p = 0; p < 2; p++) {
+        uint8_t candidate[4];
+        int error = 0;
+        for (int c = 0; c < 4; c++) {
+            const int v = std::clamp(
+                (int)std::lround((endpoint[c] - p) / 2), 0, 127);
+            candidate[c] = v;
+            const int d = ((v << 1) | p) - (int)std::lround(endpoint[c]);
+            error += d * d;
+        }
+        if (error < best_error) {
+            best_error = error;
+            p_bit = p;
+            memcpy(q, candidate, 4);
+        }
+    }
+    for (int c = 0; c < 4; c++) {
+        color[c] = (q[c] << 1) | p_bit;
+    }
+}
+
+void encode_bc7_block(const uint8_t pixels[64], uint8_t out[16]) {
+    float e0[4], e1[4];
+    fit_endpoints<4>(pixels, e0, e1);
+
+    uint8_t q[2][4], p_bits[2];
+    int endpoints[2][4];
+    quantize_bc7_endpoint(e0, q[0], p_bits[0], endpoints[0]);
+    quantize_bc7_endpoint(e1, q[1], p_bits[1], endpoints[1]);
+
+    int palette[16][4];
+    for (int i = 0; i < 16; i++) {
+        const int w = BC7_WEIGHTS_4[i];
+        for (int c = 0; c < 4; c++) {
+            palette[i][c] =
+                ((64 - w) * endpoints[0][c] + w * endpoints[1][c] + 32) >> 6;
+        }
+    }
+
+    uint8_t indices[16];
+    for (int i = 0; i < 16; i++) {
+        int best_distance = INT32_MAX;
+        for (int j = 0; j < 16; j++) {
+            const int d = distance2<4>(&pixels[4 * i], palette[j]);
+            if (d < best_distance) {
+                best_distance = d;
+                indices[i] = j;
+            }
+        }
+    }
+
+    // The first index is stored with its top bit implied to be zero, so
+    // swap the endpoints if it is set
+    if (indices[0] & 8) {
+        std::swap(q[0], q[1]);
+        std::swap(p_bits[0], p_bits[1]);
+        for (auto &index : indices) {
+            index = 15 - index;
+        }
+    }
+
+    memset(out, 0, 16);
+    BitWriter writer{out};
+    writer.write(1 << 6, 7);
+    for (int c = 0; c < 4; c++) {
+        writer.write(q[0][c], 7);
+        writer.write(q[1][c], 7);
+    }
+    writer.write(p_bits[0], 1);
+    writer.write(p_bits[1], 1);
+    writer.write(indices[0], 3);
+    for (int i = 1; i < 16; i++) {
+        writer.write(indices[i], 4);
+    }
+    assert(writer.pos == 128);
+}
+
+Image convert_to_rgba8(const Image &image) {
+    if (format_compressed(image.format()) || image.mip_levels() != 1) {
+        throw DataException("Expected a single-level uncompressed image");
+    }
+    if (image.format() == PixelFormat::Rgba8) {
+        const auto data = image.data();
+        return Image::create(PixelFormat::Rgba8, image.width(),
+                             image.height(), 1, {data.begin(), data.end()});
+    }
+
+    const auto src = image.data();
+    const auto channels = format_size(image.format());
+    const size_t pixel_count = (size_t)image.width() * image.height();
+    std::vector<char> data(4 * pixel_count);
+    for (size_t i = 0; i < pixel_count; i++) {
+        const char *pixel = &src[channels * i];
+        char *rgba = &data[4 * i];
+        switch (image.format()) {
+        case PixelFormat::R8:
+            rgba[0] = rgba[1] = rgba[2] = pixel[0];
+            rgba[3] = (char)255;
+            break;
+        case PixelFormat::Rg8:
+            rgba[0] = pixel[0];
+            rgba[1] = pixel[1];
+            rgba[2] = 0;
+            rgba[3] = (char)255;
+            break;
+        case PixelFormat::Rgb8:
+            memcpy(rgba, pixel, 3);
+            rgba[3] = (char)255;
+            break;
+        default:
+            abort();
+        }
+    }
+    return Image::create(PixelFormat::Rgba8, image.width(), image.height(), 1,
+                         std::move(data));
+}
+
+static float srgb_to_linear(uint8_t value) {
+    const float x = value / 255.0f;
+    return x <= 0.04045f ? x / 12.92f : std::pow((x + 0.055f) / 1.055f, 2.4f);
+}
+
+static uint8_t linear_to_srgb(float x) {
+    const float y =
+        x <= 0.0031308f ? 12.92f * x : 1.055f * std::pow(x, 1 / 2.4f) - 0.055f;
+    return (uint8_t)std::clamp(std::lround(255 * y), 0l, 255l);
+}
+
+Image generate_mipmaps(const Image &image) {
+    assert(image.format() == PixelFormat::Rgba8 && image.mip_levels() == 1);
+    std::array<float, 256> to_linear;
+    for (int i = 0; i < 256; i++) {
+        to_linear[i] = srgb_to_linear(i);
+    }
+
+    const uint32_t levels =
+        std::bit_width(std::max(image.width(), image.height()));
+    const auto base = image.data();
+    std::vector<char> data(base.begin(), base.end());
+
+    // Each level is a 2x2 box filter of the previous one
+    size_t src_offset = 0;
+    uint32_t src_width = image.width(), src_height = image.height();
+    for (uint32_t level = 1; level < levels; level++) {
+        const uint32_t width = std::max(src_width / 2, 1u);
+        const uint32_t height = std::max(src_height / 2, 1u);
+        const size_t dst_offset = data.size();
+        data.resize(dst_offset + 4 * (size_t)width * height);
+        const auto *src = (const uint8_t *)&data[src_offset];
+        auto *dst = (uint8_t *)&data[dst_offset];
+        for (uint32_t y = 0; y < height; y++) {
+            for (uint32_t x = 0; x < width; x++) {
+                const uint32_t x0 = std::min(2 * x, src_width - 1);
+                const uint32_t x1 = std::min(2 * x + 1, src_width - 1);
+                const uint32_t y0 = std::min(2 * y, src_height - 1);
+                const uint32_t y1 = std::min(2 * y + 1, src_height - 1);
+                const uint8_t *taps[4] = {
+                    &src[4 * (y0 * src_width + x0)],
+                    &src[4 * (y0 * src_width + x1)],
+                    &src[4 * (y1 * src_width + x0)],
+                    &src[4 * (y1 * src_width + x1)],
+                };
+                uint8_t *pixel = &dst[4 * (y * width + x)];
+                for (int c = 0; c < 3; c++) {
+                    float sum = 0;
+                    for (const auto *tap : taps) {
+                        sum += to_linear[tap[c]];
+                    }
+                    pixel[c] = linear_to_srgb(sum / 4);
+                }
+                int alpha = 0;
+                for (const auto *tap : taps) {
+                    alpha += tap[3];
+                }
+                pixel[3] = (alpha + 2) / 4;
+            }
+        }
+        src_offset = dst_offset;
+        src_width = width;
+        src_height = height;
+    }
+
+    return Image::create(PixelFormat::Rgba8, image.width(), image.height(),
+                         levels, std::move(data));
+}
+
+Image compress_image(const Image &image, PixelFormat format) {
+    assert(image.format() == PixelFormat::Rgba8);
+    assert(format_compressed(format));
+    const auto block_size = format_block_size(format);
+
+    std::vector<char> data;
+    for (uint32_t level = 0; level < image.mip_levels(); level++) {
+        const auto width = image.level_width(level);
+        const auto height = image.level_height(level);
+        const auto *src = (const uint8_t *)image.level_data(level).data();
+        size_t offset = data.size();
+        data.resize(offset + image_size(format, width, height));
+
+        for (uint32_t by = 0; by < height; by += 4) {
+            for (uint32_t bx = 0; bx < width; bx += 4) {
+                // Blocks hanging off the edge repeat the edge pixels
+                uint8_t pixels[64];
+                for (uint32_t y = 0; y < 4; y++) {
+                    for (uint32_t x = 0; x < 4; x++) {
+                        const auto sx = std::min(bx + x, width - 1);
+                        const auto sy = std::min(by + y, height - 1);
+                        memcpy(&pixels[4 * (4 * y + x)],
+                               &src[4 * (sy * width + sx)], 4);
+                    }
+                }
+                auto *out = (uint8_t *)&data[offset];
+                switch (format) {
+                case PixelFormat::Bc1:
+                    encode_bc1_block(pixels, out);
+                    break;
+                case PixelFormat::Bc3:
+                    encode_bc3_block(pixels, out);
+                    break;
+                case PixelFormat::Bc7:
+                    encode_bc7_block(pixels, out);
+                    break;
+                default:
+                    abort();
+                }
+                offset += block_size;
+            }
+        }
+    }
+
+    return Image::create(format, image.width(), image.height(),
+                         image.mip_levels(), std::move(data));
+}
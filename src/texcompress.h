@@ -0,0 +1,25 @@
+#ifndef TEXCOMPRESS_H_INCLUDED
+#define TEXCOMPRESS_H_INCLUDED
+
+#include <cstdint>
+
+#include "image.h"
+
+// Block encoders. Each takes a 4x4 block of RGBA8 pixels in row-major
+// order and writes a single compressed block.
+void encode_bc1_block(const uint8_t pixels[64], uint8_t out[8]);
+void encode_bc3_block(const uint8_t pixels[64], uint8_t out[16]);
+/// @brief Encodes a BC7 block using mode 6 only: a single subset with
+/// RGBA endpoints and 4-bit indices. Not the best quality BC7 can
+/// offer, but simple and plenty for block textures.
+void encode_bc7_block(const uint8_t pixels[64], uint8_t out[16]);
+
+/// @brief Converts a single-level uncompressed image to RGBA8.
+Image convert_to_rgba8(const Image &image);
+/// @brief Returns a copy of an RGBA8 image with a full mip chain. Color
+/// is averaged in linear space.
+Image generate_mipmaps(const Image &image);
+/// @brief Compresses every mip level of an RGBA8 image.
+Image compress_image(const Image &image, PixelFormat format);
+
+#endif
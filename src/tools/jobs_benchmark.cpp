@@ -0,0 +1,119 @@
+// Measures how the job system scales on a synthetic chunk workload:
+// filling chunks from a height field, then counting the faces a mesher
+// would emit, with each phase spread over the job system.
+//
+// Usage: jobs_benchmark [chunk count]
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "jobs.h"
+
+const int CHUNK_SIZE = 32;
+const int REPETITIONS = 5;
+
+struct SyntheticChunk {
+    std::vector<uint8_t> blocks =
+        std::vector<uint8_t>(CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE);
+    size_t faces = 0;
+
+    uint8_t at(int i, int j, int k) const {
+        return blocks[(i * CHUNK_SIZE + j) * CHUNK_SIZE + k];
+    }
+};
+
+static float height(float x, float y) {
+    float h = 0;
+    // A few octaves so generation costs about what real terrain would
+    for (int octave = 0; octave < 4; octave++) {
+        const float scale = 1 << octave;
+        h += (sinf(x * 0.05f * scale) + cosf(y * 0.07f * scale)) / scale;
+    }
+    return 8 * h + CHUNK_SIZE / 2;
+}
+
+static void generate(SyntheticChunk &chunk, size_t index) {
+    const float x0 = index * CHUNK_SIZE;
+    for (int i = 0; i < CHUNK_SIZE; i++) {
+        for (int j = 0; j < CHUNK_SIZE; j++) {
+            const float h = height(x0 + i, j);
+            for (int k = 0; k < CHUNK_SIZE; k++) {
+                chunk.blocks[(i * CHUNK_SIZE + j) * CHUNK_SIZE + k] = k <= h;
+            }
+        }
+    }
+}
+
+static void mesh(SyntheticChunk &chunk) {
+    size_t faces = 0;
+    for (int i = 1; i < CHUNK_SIZE; i++) {
+        for (int j = 1; j < CHUNK_SIZE; j++) {
+            for (int k = 1; k < CHUNK_SIZE; k++) {
+                const auto block = chunk.at(i, j, k);
+                faces += block != chunk.at(i - 1, j, k);
+                faces += block != chunk.at(i, j - 1, k);
+                faces += block != chunk.at(i, j, k - 1);
+            }
+        }
+    }
+    chunk.faces = faces;
+}
+
+// Returns the best of several runs in milliseconds
+static double run(size_t threads, size_t chunk_count, size_t &faces) {
+    JobSystem jobs{threads - 1};
+    double best = 1e30;
+    for (int r = 0; r < REPETITIONS; r++) {
+        std::vector<SyntheticChunk> chunks(chunk_count);
+        const auto start = std::chrono::steady_clock::now();
+
+        // Meshing is queued up front and held back until generation has
+        // finished, like meshing waits for a chunk's neighbors
+        JobCounter generated, meshed;
+        for (size_t i = 0; i < chunk_count; i++) {
+            jobs.run([&chunks, i]() { generate(chunks[i], i); }, generated);
+        }
+        for (size_t i = 0; i < chunk_count; i++) {
+            jobs.run([&chunks, i]() { mesh(chunks[i]); }, meshed, &generated);
+        }
+        jobs.wait(meshed);
+
+        std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+        faces = 0;
+        for (const auto &chunk : chunks) {
+            faces += chunk.faces;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    const size_t chunk_count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1024;
+    const size_t max_threads = JobSystem::default_worker_count() + 1;
+
+    std::cout << chunk_count << " chunks of " << CHUNK_SIZE << "^3 blocks\n";
+    std::cout << "threads\tms\tspeedup\n";
+    double baseline = 0;
+    size_t expected_faces = 0;
+    for (size_t threads = 1;; threads = std::min(threads * 2, max_threads)) {
+        size_t faces;
+        const double ms = run(threads, chunk_count, faces);
+        if (threads == 1) {
+            baseline = ms;
+            expected_faces = faces;
+        } else if (faces != expected_faces) {
+            std::cerr << "jobs_benchmark: results differ between runs\n";
+            return 1;
+        }
+        std::cout << threads << "\t" << ms << "\t" << baseline / ms << "\n";
+        if (threads == max_threads) {
+            break;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,80 @@
+// Packs a directory of assets into a single archive.
+//
+// Usage: pack [--compress] <asset root> <output.pak>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "archive.h"
+#include "exceptions.h"
+
+static void usage() {
+    std::cerr << "usage: pack [--compress] <asset root> <output.pak>\n";
+}
+
+static std::vector<char> read_file(const std::filesystem::path &path) {
+    std::ifstream f(path, std::ios_base::binary);
+    if (!f.good()) {
+        throw SystemException("Cannot read file: " + path.string());
+    }
+    return std::vector(std::istreambuf_iterator{f}, {});
+}
+
+// Already-compressed formats aren't worth spending time on
+static bool compressible(const std::filesystem::path &path) {
+    const auto extension = path.extension();
+    return extension != ".png" && extension != ".tex";
+}
+
+int main(int argc, char **argv) {
+    bool compress = false;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--compress")) {
+            compress = true;
+        } else {
+            paths.push_back(argv[i]);
+        }
+    }
+    if (paths.size() != 2) {
+        usage();
+        return 1;
+    }
+
+    try {
+        const std::filesystem::path root = paths[0];
+        ArchiveWriter writer;
+        // The asset root is commonly set up with symlinks into a checkout
+        const auto options =
+            std::filesystem::directory_options::follow_directory_symlink;
+        for (const auto &file :
+             std::filesystem::recursive_directory_iterator(root, options)) {
+            if (!file.is_regular_file()) {
+                continue;
+            }
+            const auto name =
+                file.path().lexically_relative(root).generic_string();
+            writer.add(name, read_file(file.path()),
+                       compress && compressible(file.path()));
+        }
+
+        if (writer.size() == 0) {
+            throw SystemException("No files found under " + root.string());
+        }
+
+        const auto bytes = writer.build();
+        std::ofstream f(paths[1], std::ios_base::binary);
+        f.write(bytes.data(), bytes.size());
+        if (!f.good()) {
+            throw SystemException("Cannot write file: " + paths[1]);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "pack: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,78 @@
+// Converts PNG textures into block-compressed .tex files.
+//
+// Usage: texcompress [-f bc1|bc3|bc7] [--no-mips] <input.png> <output.tex>
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "exceptions.h"
+#include "image.h"
+#include "texcompress.h"
+
+static void usage() {
+    std::cerr << "usage: texcompress [-f bc1|bc3|bc7] [--no-mips] "
+                 "<input.png> <output.tex>\n";
+}
+
+static PixelFormat parse_format(const std::string &name) {
+    if (name == "bc1") {
+        return PixelFormat::Bc1;
+    } else if (name == "bc3") {
+        return PixelFormat::Bc3;
+    } else if (name == "bc7") {
+        return PixelFormat::Bc7;
+    }
+    throw DataException("Unknown format: " + name);
+}
+
+static std::vector<char> read_file(const std::string &path) {
+    std::ifstream f(path, std::ios_base::binary);
+    if (!f.good()) {
+        throw SystemException("Cannot read file: " + path);
+    }
+    return std::vector(std::istreambuf_iterator{f}, {});
+}
+
+static void write_file(const std::string &path, const std::vector<char> &data) {
+    std::ofstream f(path, std::ios_base::binary);
+    f.write(data.data(), data.size());
+    if (!f.good()) {
+        throw SystemException("Cannot write file: " + path);
+    }
+}
+
+int main(int argc, char **argv) {
+    PixelFormat format = PixelFormat::Bc7;
+    bool mips = true;
+    std::vector<std::string> paths;
+    try {
+        for (int i = 1; i < argc; i++) {
+            if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+                format = parse_format(argv[++i]);
+            } else if (!strcmp(argv[i], "--no-mips")) {
+                mips = false;
+            } else {
+                paths.push_back(argv[i]);
+            }
+        }
+        if (paths.size() != 2) {
+            usage();
+            return 1;
+        }
+
+        const auto png = Image::load(read_file(paths[0]));
+        auto image = convert_to_rgba8(png);
+        if (mips) {
+            image = generate_mipmaps(image);
+        }
+        const auto compressed = compress_image(image, format);
+        write_file(paths[1], compressed.save_tex());
+    } catch (const std::exception &e) {
+        std::cerr << "texcompress: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,246 @@
+#include "vulkan/defragment.h"
+
+#include <cassert>
+#include <utility>
+
+static vk::raii::CommandPool create_command_pool(VulkanDevice &device) {
+    vk::CommandPoolCreateInfo info;
+    info.flags = vk::CommandPoolCreateFlagBits::eTransient;
+    info.queueFamilyIndex = 0;
+    return device->createCommandPool(info, nullptr);
+}
+
+static vk::raii::CommandBuffer
+allocate_command_buffer(VulkanDevice &device,
+                        const vk::raii::CommandPool &pool) {
+    vk::CommandBufferAllocateInfo info;
+    info.commandPool = *pool;
+    info.level = vk::CommandBufferLevel::ePrimary;
+    info.commandBufferCount = 1;
+    auto buffers = device->allocateCommandBuffers(info);
+    return std::move(buffers[0]);
+}
+
+MeshDefragmenter::MeshDefragmenter(std::shared_ptr<VulkanAllocator> allocator,
+                                   MeshRegistry &meshes)
+    : m_allocator{std::move(allocator)}, m_meshes{meshes},
+      m_semaphore{m_allocator->device().create_semaphore(
+          vk::SemaphoreType::eTimeline)},
+      m_command_pool{create_command_pool(m_allocator->device())},
+      m_command_buffer{
+          allocate_command_buffer(m_allocator->device(), m_command_pool)} {
+    auto &device = m_allocator->device();
+    if (device.debug()) {
+        device.set_name(*m_semaphore, "MeshDefragmenter.m_semaphore");
+        device.set_name(*m_command_pool, "MeshDefragmenter.m_command_pool");
+        device.set_name(*m_command_buffer,
+                        "MeshDefragmenter.m_command_buffer");
+    }
+    m_allocator->m_defragmenter = this;
+}
+
+MeshDefragmenter::~MeshDefragmenter() {
+    if (m_state == State::Copying) {
+        vk::SemaphoreWaitInfo info;
+        info.setSemaphores(*m_semaphore);
+        info.setValues(m_batch);
+        std::ignore = m_allocator->device()->waitSemaphores(info, UINT64_MAX);
+        swap_buffers();
+        m_state = State::Retiring;
+    }
+    if (m_state == State::Retiring) {
+        end_pass();
+    }
+    if (m_context) {
+        vmaEndDefragmentation(m_allocator->m_allocator, m_context, nullptr);
+    }
+    m_allocator->m_defragmenter = nullptr;
+}
+
+bool MeshDefragmenter::fragmented() const {
+    VmaStatistics stats;
+    vmaGetPoolStatistics(m_allocator->m_allocator, m_allocator->m_mesh_pool,
+                         &stats);
+    return stats.blockCount > 1 &&
+           stats.allocationBytes <
+               DEFRAG_OCCUPANCY_THRESHOLD * stats.blockBytes;
+}
+
+void MeshDefragmenter::step(vk::raii::Queue &queue, uint64_t frame,
+                            uint64_t completed_frame) {
+    switch (m_state) {
+    case State::Idle: {
+        if (frame < m_next_check_frame || !fragmented()) {
+            return;
+        }
+        VmaDefragmentationInfo info = {};
+        info.flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_BALANCED_BIT;
+        info.pool = m_allocator->m_mesh_pool;
+        info.maxBytesPerPass = DEFRAG_MAX_BYTES_PER_PASS;
+        vmaBeginDefragmentation(m_allocator->m_allocator, &info, &m_context);
+        begin_pass(queue, frame);
+        break;
+    }
+    case State::BeginPass:
+        begin_pass(queue, frame);
+        break;
+    case State::Copying:
+        if (m_semaphore.getCounterValue() < m_batch) {
+            return;
+        }
+        swap_buffers();
+        // Frames up to this one may still read the old memory
+        m_retire_frame = frame;
+        m_state = State::Retiring;
+        break;
+    case State::Retiring:
+        if (completed_frame < m_retire_frame) {
+            return;
+        }
+        if (end_pass()) {
+            finish(frame);
+        } else {
+            m_state = State::BeginPass;
+        }
+        break;
+    }
+}
+
+void MeshDefragmenter::begin_pass(vk::raii::Queue &queue, uint64_t frame) {
+    auto result = vmaBeginDefragmentationPass(m_allocator->m_allocator,
+                                              m_context, &m_pass);
+    if (result == VK_SUCCESS) {
+        // Nothing left to move
+        finish(frame);
+        return;
+    }
+
+    record_moves();
+    m_batch++;
+
+    vk::CommandBufferSubmitInfo cmd_info;
+    cmd_info.commandBuffer = *m_command_buffer;
+    vk::SemaphoreSubmitInfo sem_info;
+    sem_info.semaphore = *m_semaphore;
+    sem_info.value = m_batch;
+    sem_info.stageMask = vk::PipelineStageFlagBits2::eAllTransfer;
+    vk::SubmitInfo2 info;
+    info.setCommandBufferInfos(cmd_info);
+    info.setSignalSemaphoreInfos(sem_info);
+    queue.submit2(info);
+
+    m_state = State::Copying;
+}
+
+void MeshDefragmenter::record_moves() {
+    const auto start = std::chrono::steady_clock::now();
+    auto &device = m_allocator->device();
+
+    m_command_pool.reset();
+    vk::CommandBufferBeginInfo begin_info;
+    begin_info.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    m_command_buffer.begin(begin_info);
+
+    m_moves.clear();
+    m_moves.resize(m_pass.moveCount);
+    for (uint32_t i = 0; i < m_pass.moveCount; i++) {
+        auto &move = m_pass.pMoves[i];
+        // Always move at least one allocation so we make progress
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        if (i > 0 && elapsed > DEFRAG_TIME_BUDGET) {
+            move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+            continue;
+        }
+
+        // Meshes that are already destroyed are freed the usual way
+        const auto src = m_meshes.find_buffer(move.srcAllocation);
+        if (!src.buffer) {
+            move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+            continue;
+        }
+
+        vk::BufferCreateInfo buffer_info;
+        buffer_info.size = src.size;
+        buffer_info.usage = MESH_BUFFER_USAGE;
+        vk::raii::Buffer buffer{*device, buffer_info};
+        vmaBindBufferMemory(m_allocator->m_allocator, move.dstTmpAllocation,
+                            *buffer);
+
+        vk::BufferCopy2 copy;
+        copy.size = src.size;
+        vk::CopyBufferInfo2 copy_info;
+        copy_info.srcBuffer = *src.buffer;
+        copy_info.dstBuffer = *buffer;
+        copy_info.setRegions(copy);
+        m_command_buffer.copyBuffer2(copy_info);
+
+        m_moves[i].buffer = std::move(buffer);
+        m_moving.insert({move.srcAllocation, i});
+    }
+
+    // Make the copies visible to draws submitted after the swap
+    vk::MemoryBarrier2 barrier;
+    barrier.srcStageMask = vk::PipelineStageFlagBits2::eAllTransfer;
+    barrier.srcAccessMask = vk::AccessFlagBits2::eTransferWrite;
+    barrier.dstStageMask = vk::PipelineStageFlagBits2::eVertexAttributeInput |
+                           vk::PipelineStageFlagBits2::eIndexInput;
+    barrier.dstAccessMask = vk::AccessFlagBits2::eVertexAttributeRead |
+                            vk::AccessFlagBits2::eIndexRead;
+    vk::DependencyInfo dep;
+    dep.setMemoryBarriers(barrier);
+    m_command_buffer.pipelineBarrier2(dep);
+
+    m_command_buffer.end();
+}
+
+void MeshDefragmenter::swap_buffers() {
+    auto &device = m_allocator->device();
+    for (uint32_t i = 0; i < m_pass.moveCount; i++) {
+        auto &move = m_moves[i];
+        if (move.abandoned || !move.buffer) {
+            continue;
+        }
+        const auto dst = m_meshes.find_buffer(m_pass.pMoves[i].srcAllocation);
+        if (!dst.buffer) {
+            // Destroyed, but not yet freed. Leave it where it is and let
+            // the registry free it as usual.
+            m_pass.pMoves[i].operation =
+                VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+            m_moving.erase(m_pass.pMoves[i].srcAllocation);
+            move.buffer.reset();
+            continue;
+        }
+        const auto old_buffer = *dst.buffer;
+        *dst.buffer = move.buffer->release();
+        move.buffer.emplace(*device, old_buffer);
+    }
+}
+
+bool MeshDefragmenter::end_pass() {
+    // Destroys the old buffers before their memory goes away. The
+    // allocation handles then refer to the new memory.
+    m_moves.clear();
+    m_moving.clear();
+    auto result = vmaEndDefragmentationPass(m_allocator->m_allocator,
+                                            m_context, &m_pass);
+    return result == VK_SUCCESS;
+}
+
+void MeshDefragmenter::finish(uint64_t frame) {
+    vmaEndDefragmentation(m_allocator->m_allocator, m_context, nullptr);
+    m_context = nullptr;
+    m_state = State::Idle;
+    m_next_check_frame = frame + DEFRAG_COOLDOWN_FRAMES;
+}
+
+bool MeshDefragmenter::abandon(VmaAllocation allocation) {
+    auto it = m_moving.find(allocation);
+    if (it == m_moving.end()) {
+        return false;
+    }
+    const auto index = it->second;
+    m_moves[index].abandoned = true;
+    m_pass.pMoves[index].operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_DESTROY;
+    m_moving.erase(it);
+    return true;
+}
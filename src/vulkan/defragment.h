@@ -0,0 +1,100 @@
+#ifndef VULKAN_DEFRAGMENT_H_INCLUDED
+#define VULKAN_DEFRAGMENT_H_INCLUDED
+
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan_raii.hpp>
+
+#include "vulkan/memory.h"
+#include "vulkan/mesh.h"
+
+/// Upper bound on the bytes copied by a single defragmentation pass.
+const vk::DeviceSize DEFRAG_MAX_BYTES_PER_PASS = 0x40'0000;
+/// CPU time a pass may spend recording moves before leaving the rest
+/// for a later pass.
+const std::chrono::microseconds DEFRAG_TIME_BUDGET{500};
+/// Defragmentation starts once less than this fraction of the mesh
+/// pool's memory blocks is in use.
+const float DEFRAG_OCCUPANCY_THRESHOLD = 0.75;
+/// Frames to wait after a defragmentation before checking again.
+const uint64_t DEFRAG_COOLDOWN_FRAMES = 600;
+
+/// @brief Incrementally compacts the mesh pool using VMA's
+/// defragmentation API.
+///
+/// Each pass copies a bounded number of meshes into their new place on
+/// the GPU. Once the copies finish, the meshes in the registry are
+/// rebound to buffers in the new memory. The old memory is released
+/// only after every frame that could still be reading from it has
+/// completed, so rendering never has to stall.
+class MeshDefragmenter {
+    enum class State {
+        Idle,
+        BeginPass,
+        Copying,
+        Retiring,
+    };
+
+    // Mirrors VmaDefragmentationPassMoveInfo::pMoves. The owning mesh
+    // is looked up through the allocation's user data each time since
+    // it may have been destroyed in the meantime.
+    struct Move {
+        // Buffer bound to the new memory while the copy is in flight.
+        // After the swap, holds the old buffer until it is retired.
+        std::optional<vk::raii::Buffer> buffer;
+        bool abandoned = false;
+    };
+
+    std::shared_ptr<VulkanAllocator> m_allocator;
+    MeshRegistry &m_meshes;
+    vk::raii::Semaphore m_semaphore;
+    vk::raii::CommandPool m_command_pool;
+    vk::raii::CommandBuffer m_command_buffer;
+
+    State m_state = State::Idle;
+    VmaDefragmentationContext m_context = nullptr;
+    VmaDefragmentationPassMoveInfo m_pass = {};
+    std::vector<Move> m_moves;
+    std::unordered_map<VmaAllocation, size_t> m_moving;
+    uint64_t m_batch = 0;
+    uint64_t m_retire_frame = 0;
+    uint64_t m_next_check_frame = 0;
+
+    bool fragmented() const;
+    void begin_pass(vk::raii::Queue &queue, uint64_t frame);
+    void record_moves();
+    void swap_buffers();
+    bool end_pass();
+    void finish(uint64_t frame);
+
+public:
+    MeshDefragmenter(std::shared_ptr<VulkanAllocator> allocator,
+                     MeshRegistry &meshes);
+    MeshDefragmenter(const MeshDefragmenter &other) = delete;
+    MeshDefragmenter &operator=(const MeshDefragmenter &other) = delete;
+    /// Must only be destroyed once the device is idle.
+    ~MeshDefragmenter();
+
+    bool active() const { return m_state != State::Idle; }
+
+    /// @brief Advances defragmentation by at most one step. Should be
+    /// called once per frame after the frame has been submitted.
+    ///
+    /// `frame` is the most recently submitted frame and
+    /// `completed_frame` the newest frame such that it and every frame
+    /// before it have finished executing.
+    void step(vk::raii::Queue &queue, uint64_t frame,
+              uint64_t completed_frame);
+
+    /// @brief Called when an allocation is freed. Returns true if the
+    /// allocation is being moved, in which case it is freed at the end
+    /// of the pass instead.
+    bool abandon(VmaAllocation allocation);
+};
+
+#endif
@@ -17,7 +17,8 @@ void load_vulkan_library() {
 }
 
 SwapchainSettings validate_device(const vk::raii::SurfaceKHR &surface,
-                                  const vk::raii::PhysicalDevice &device) {
+                                  const vk::raii::PhysicalDevice &device,
+                                  vk::PresentModeKHR preferred_present_mode) {
     const auto id = device.getProperties().deviceID;
     if (!device.getSurfaceSupportKHR(0, *surface)) {
         throw SystemException(
@@ -44,14 +45,13 @@ SwapchainSettings validate_device(const vk::raii::SurfaceKHR &surface,
     const auto color_space = selected_format->colorSpace;
     const auto format = selected_format->format;
 
+    // FIFO is the only mode every implementation supports
     const auto present_modes = device.getSurfacePresentModesKHR(*surface);
-    auto present_mode = vk::PresentModeKHR::eImmediate;
+    auto present_mode = vk::PresentModeKHR::eFifo;
     for (const auto &mode : present_modes) {
-        if (mode == vk::PresentModeKHR::eFifo) {
+        if (mode == preferred_present_mode) {
             present_mode = mode;
             break;
-        } else if (mode == vk::PresentModeKHR::eFifoRelaxed) {
-            present_mode = mode;
         }
     }
 
@@ -62,15 +62,49 @@ SwapchainSettings validate_device(const vk::raii::SurfaceKHR &surface,
     };
 }
 
+SwapchainSettings
+validate_headless_device(const vk::raii::PhysicalDevice &device) {
+    const auto id = device.getProperties().deviceID;
+    const auto required = vk::FormatFeatureFlagBits::eColorAttachment |
+                          vk::FormatFeatureFlagBits::eTransferSrc;
+    const auto properties = device.getFormatProperties(OFFSCREEN_FORMAT);
+    if ((properties.optimalTilingFeatures & required) != required) {
+        throw SystemException(std::format(
+            "Device {} does not support required pixel format", id));
+    }
+    return SwapchainSettings{
+        OFFSCREEN_FORMAT,
+        vk::ColorSpaceKHR::eSrgbNonlinear,
+        vk::PresentModeKHR::eFifo,
+    };
+}
+
 VulkanDevice VulkanDevice::create(SDL_Window *window, uint32_t device_id,
-                                  bool debug) {
+                                  bool debug,
+                                  vk::PresentModeKHR present_mode) {
+    return create(window, {}, device_id, debug, present_mode);
+}
+
+VulkanDevice VulkanDevice::create_headless(uint32_t device_id, bool debug,
+                                           vk::Extent2D extent) {
+    return create(nullptr, extent, device_id, debug,
+                  vk::PresentModeKHR::eFifo);
+}
+
+VulkanDevice VulkanDevice::create(SDL_Window *window,
+                                  vk::Extent2D headless_extent,
+                                  uint32_t device_id, bool debug,
+                                  vk::PresentModeKHR present_mode) {
     std::vector<const char *> requested_layers;
     std::vector<const char *> required_extensions;
 
-    unsigned int count;
-    SDL_Vulkan_GetInstanceExtensions(window, &count, nullptr);
-    required_extensions.resize(count);
-    SDL_Vulkan_GetInstanceExtensions(window, &count, &required_extensions[0]);
+    if (window) {
+        unsigned int count;
+        SDL_Vulkan_GetInstanceExtensions(window, &count, nullptr);
+        required_extensions.resize(count);
+        SDL_Vulkan_GetInstanceExtensions(window, &count,
+                                         &required_extensions[0]);
+    }
 
     if (debug) {
         requested_layers.push_back("VK_LAYER_KHRONOS_validation");
@@ -104,11 +138,19 @@ VulkanDevice VulkanDevice::create(SDL_Window *window, uint32_t device_id,
     inst_info.setPEnabledLayerNames(requested_layers);
     vk::raii::Instance instance(context, inst_info);
 
-    VkSurfaceKHR vk_surface;
-    if (SDL_Vulkan_CreateSurface(window, *instance, &vk_surface) != SDL_TRUE) {
-        throw SystemException("Failed to create surface");
+    vk::raii::SurfaceKHR surface{nullptr};
+    if (window) {
+        VkSurfaceKHR vk_surface;
+        if (SDL_Vulkan_CreateSurface(window, *instance, &vk_surface) !=
+            SDL_TRUE) {
+            throw SystemException("Failed to create surface");
+        }
+        surface = vk::raii::SurfaceKHR{instance, vk_surface, nullptr};
     }
-    vk::raii::SurfaceKHR surface{instance, vk_surface, nullptr};
+    const auto validate = [&](const vk::raii::PhysicalDevice &pdev) {
+        return window ? validate_device(surface, pdev, present_mode)
+                      : validate_headless_device(pdev);
+    };
 
     vk::raii::PhysicalDevices phys_devices{instance};
     vk::raii::PhysicalDevice *selected = nullptr;
@@ -117,7 +159,7 @@ VulkanDevice VulkanDevice::create(SDL_Window *window, uint32_t device_id,
         for (vk::raii::PhysicalDevice &pdev : phys_devices) {
             const auto properties = pdev.getProperties();
             if (properties.deviceID == device_id) {
-                sw_settings = validate_device(surface, pdev);
+                sw_settings = validate(pdev);
                 selected = &pdev;
                 break;
             }
@@ -126,7 +168,7 @@ VulkanDevice VulkanDevice::create(SDL_Window *window, uint32_t device_id,
     } else if (!phys_devices.empty()) {
         for (auto &pdev : phys_devices) {
             try {
-                sw_settings = validate_device(surface, pdev);
+                sw_settings = validate(pdev);
                 selected = &pdev;
                 break;
             } catch (const std::exception &e) {
@@ -146,7 +188,9 @@ VulkanDevice VulkanDevice::create(SDL_Window *window, uint32_t device_id,
     }
 
     required_extensions.clear();
-    required_extensions.push_back("VK_KHR_swapchain");
+    if (window) {
+        required_extensions.push_back("VK_KHR_swapchain");
+    }
     required_extensions.push_back("VK_KHR_push_descriptor");
 
     // Configure graphics queue
@@ -181,6 +225,8 @@ VulkanDevice VulkanDevice::create(SDL_Window *window, uint32_t device_id,
     vk::PhysicalDeviceFeatures2 features;
     features.pNext = &desc_indexing_features;
     features.features.samplerAnisotropy = 1;
+    const bool texture_compression_bc = pdev.getFeatures().textureCompressionBC;
+    features.features.textureCompressionBC = texture_compression_bc;
 
     vk::DeviceCreateInfo dev_info;
     dev_info.setQueueCreateInfos(queue_info);
@@ -197,6 +243,8 @@ VulkanDevice VulkanDevice::create(SDL_Window *window, uint32_t device_id,
                         std::move(graphics_queue),
                         std::move(surface),
                         sw_settings};
+    device.m_texture_compression_bc = texture_compression_bc;
+    device.m_headless_extent = headless_extent;
     return device;
 }
 
@@ -209,13 +257,96 @@ VulkanDevice::create_semaphore(vk::SemaphoreType type) const {
     return m_device.createSemaphore(info, nullptr);
 }
 
+static uint32_t find_memory_type(const vk::raii::PhysicalDevice &device,
+                                 uint32_t type_bits,
+                                 vk::MemoryPropertyFlags flags) {
+    const auto properties = device.getMemoryProperties();
+    for (uint32_t i = 0; i < properties.memoryTypeCount; i++) {
+        if ((type_bits & (1 << i)) &&
+            (properties.memoryTypes[i].propertyFlags & flags) == flags) {
+            return i;
+        }
+    }
+    throw OutOfMemoryException("No suitable memory type");
+}
+
+// The allocator belongs to the renderer, which is created after the
+// swapchain, so the images share one plain allocation instead.
+VulkanSwapchain VulkanSwapchain::create_offscreen(const VulkanDevice &device) {
+    const auto settings = device.m_swapchain_settings;
+    const auto extent = device.m_headless_extent;
+    vk::ImageCreateInfo info;
+    info.imageType = vk::ImageType::e2D;
+    info.format = settings.format;
+    info.extent = vk::Extent3D{extent, 1};
+    info.mipLevels = 1;
+    info.arrayLayers = 1;
+    info.samples = vk::SampleCountFlagBits::e1;
+    info.tiling = vk::ImageTiling::eOptimal;
+    info.usage = vk::ImageUsageFlagBits::eColorAttachment |
+                 vk::ImageUsageFlagBits::eTransferSrc;
+    info.initialLayout = vk::ImageLayout::eUndefined;
+
+    std::vector<vk::raii::Image> offscreen_images;
+    std::vector<vk::DeviceSize> offsets;
+    vk::DeviceSize size = 0;
+    uint32_t type_bits = 0xffffffff;
+    for (uint32_t i = 0; i < OFFSCREEN_IMAGE_COUNT; i++) {
+        auto image = device->createImage(info, nullptr);
+        const auto requirements = image.getMemoryRequirements();
+        size = (size + requirements.alignment - 1) / requirements.alignment *
+               requirements.alignment;
+        offsets.push_back(size);
+        size += requirements.size;
+        type_bits &= requirements.memoryTypeBits;
+        offscreen_images.push_back(std::move(image));
+    }
+    vk::MemoryAllocateInfo alloc_info;
+    alloc_info.allocationSize = size;
+    alloc_info.memoryTypeIndex =
+        find_memory_type(device.physical_device(), type_bits,
+                         vk::MemoryPropertyFlagBits::eDeviceLocal);
+    auto memory = device->allocateMemory(alloc_info, nullptr);
+
+    std::vector<vk::Image> images;
+    std::vector<vk::raii::ImageView> image_views;
+    for (size_t i = 0; i < offscreen_images.size(); i++) {
+        offscreen_images[i].bindMemory(*memory, offsets[i]);
+        images.push_back(*offscreen_images[i]);
+        vk::ImageViewCreateInfo view_info;
+        view_info.image = images[i];
+        view_info.viewType = vk::ImageViewType::e2D;
+        view_info.format = settings.format;
+        view_info.subresourceRange = vk::ImageSubresourceRange{
+            vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1};
+        image_views.push_back(device->createImageView(view_info, nullptr));
+    }
+
+    auto sw = VulkanSwapchain{device, vk::raii::SwapchainKHR{nullptr},
+                              std::move(images), std::move(image_views)};
+    sw.m_offscreen_memory = std::move(memory);
+    sw.m_offscreen_images = std::move(offscreen_images);
+    sw.m_width = extent.width;
+    sw.m_height = extent.height;
+    return sw;
+}
+
 VulkanSwapchain VulkanSwapchain::create(const VulkanDevice &device,
-                                        vk::SwapchainKHR old_swapchain) {
+                                        vk::SwapchainKHR old_swapchain,
+                                        vk::Extent2D extent) {
+    if (device.headless()) {
+        return create_offscreen(device);
+    }
     const auto settings = device.m_swapchain_settings;
-    int w, h;
-    SDL_Vulkan_GetDrawableSize(device.m_window, &w, &h);
+    int w = extent.width, h = extent.height;
     const auto capabilities =
         device.physical_device().getSurfaceCapabilitiesKHR(*device.m_surface);
+    // The window may have been resized again since the drawable size
+    // was read; the surface's limits are authoritative
+    w = std::clamp<int>(w, capabilities.minImageExtent.width,
+                        capabilities.maxImageExtent.width);
+    h = std::clamp<int>(h, capabilities.minImageExtent.height,
+                        capabilities.maxImageExtent.height);
     vk::SwapchainCreateInfoKHR sw_info;
     sw_info.setSurface(*device.m_surface);
     sw_info.minImageCount = capabilities.minImageCount + 1;
@@ -251,24 +382,73 @@ VulkanSwapchain VulkanSwapchain::create(const VulkanDevice &device,
     return sw;
 }
 
-void VulkanSwapchain::acquire_next_image(uint64_t timeout) {
-    auto result = m_swapchain.acquireNextImage(
-        timeout, *m_image_available_semaphore, nullptr);
+RetiredSwapchain VulkanSwapchain::recreate(vk::Extent2D extent) {
+    auto next = create(m_device, *m_swapchain, extent);
+    RetiredSwapchain retired{std::move(m_offscreen_memory),
+                             std::move(m_offscreen_images),
+                             std::move(m_swapchain), std::move(m_image_views),
+                             std::move(m_present_semaphores), 0};
+    m_offscreen_memory = std::move(next.m_offscreen_memory);
+    m_offscreen_images = std::move(next.m_offscreen_images);
+    m_swapchain = std::move(next.m_swapchain);
+    m_images = std::move(next.m_images);
+    m_image_views = std::move(next.m_image_views);
+    m_present_semaphores = std::move(next.m_present_semaphores);
+    m_width = next.m_width;
+    m_height = next.m_height;
+    m_acquired_image = 0xffffffff;
+    m_out_of_date = false;
+    return retired;
+}
+
+bool VulkanSwapchain::acquire_next_image(uint64_t timeout,
+                                         const vk::Semaphore &semaphore) {
+    if (offscreen()) {
+        // Reusing an image is ordered by the renderer's barriers, as
+        // everything is submitted to the same queue
+        m_acquired_image = m_next_offscreen_image;
+        m_next_offscreen_image = (m_acquired_image + 1) % m_images.size();
+        return true;
+    }
+    std::pair<vk::Result, uint32_t> result;
+    try {
+        result = m_swapchain.acquireNextImage(timeout, semaphore, nullptr);
+    } catch (const vk::OutOfDateKHRError &e) {
+        m_out_of_date = true;
+        return false;
+    }
     if (result.first == vk::Result::eTimeout) {
         throw TimeoutException("Timed out waiting for swapchain image");
     }
+    // A suboptimal image was still acquired and the semaphore will be
+    // signaled, so render this frame and recreate before the next one
+    if (result.first == vk::Result::eSuboptimalKHR) {
+        m_out_of_date = true;
+    }
     m_acquired_image = result.second;
+    return true;
 }
 
-void VulkanSwapchain::present(vk::raii::Queue &queue,
-                              std::span<const vk::Semaphore> wait_semaphores) {
+void VulkanSwapchain::present(vk::raii::Queue &queue) {
+    if (offscreen()) {
+        return;
+    }
     vk::PresentInfoKHR info;
-    info.setWaitSemaphores(wait_semaphores);
+    info.setWaitSemaphores(*current_present_semaphore());
     info.setSwapchains(*m_swapchain);
     info.setImageIndices(m_acquired_image);
     info.pResults = nullptr;
-    auto result = queue.presentKHR(info);
+    vk::Result result;
+    try {
+        result = queue.presentKHR(info);
+    } catch (const vk::OutOfDateKHRError &e) {
+        result = vk::Result::eErrorOutOfDateKHR;
+    }
     if (result == vk::Result::eErrorDeviceLost) {
         throw DeviceLostException("Graphics device lost");
     }
+    if (result == vk::Result::eErrorOutOfDateKHR ||
+        result == vk::Result::eSuboptimalKHR) {
+        m_out_of_date = true;
+    }
 }
@@ -2,6 +2,7 @@
 #define VULKAN_INSTANCE_H_INCLUDED
 
 #include <span>
+#include <vector>
 
 #include <SDL2/SDL.h>
 #include <vulkan/vulkan.h>
@@ -12,6 +13,11 @@ class VulkanSwapchain;
 
 void load_vulkan_library();
 
+/// Format of the offscreen color targets used in place of swapchain
+/// images when there is no window.
+const vk::Format OFFSCREEN_FORMAT = vk::Format::eR8G8B8A8Srgb;
+const uint32_t OFFSCREEN_IMAGE_COUNT = 3;
+
 struct SwapchainSettings {
     vk::Format format;
     vk::ColorSpaceKHR color_space;
@@ -19,6 +25,7 @@ struct SwapchainSettings {
 };
 
 class VulkanDevice {
+    /// Null for a headless device
     SDL_Window *m_window;
     vk::raii::Context m_context;
     vk::raii::Instance m_instance;
@@ -29,9 +36,15 @@ class VulkanDevice {
     SwapchainSettings m_swapchain_settings;
 
     bool m_debug;
+    bool m_texture_compression_bc = false;
+    vk::Extent2D m_headless_extent;
 
     friend class VulkanSwapchain;
 
+    static auto create(SDL_Window *window, vk::Extent2D headless_extent,
+                       uint32_t device_id, bool debug,
+                       vk::PresentModeKHR present_mode) -> VulkanDevice;
+
 public:
     VulkanDevice(SDL_Window *window, vk::raii::Context context,
                  vk::raii::Instance instance,
@@ -47,8 +60,15 @@ public:
           m_surface{std::move(surface)},
           m_swapchain_settings(swapchain_settings) {}
 
-    static auto create(SDL_Window *window, uint32_t device_id, bool debug)
-        -> VulkanDevice;
+    /// @brief Falls back to FIFO if `present_mode` isn't supported.
+    static auto create(SDL_Window *window, uint32_t device_id, bool debug,
+                       vk::PresentModeKHR present_mode =
+                           vk::PresentModeKHR::eFifo) -> VulkanDevice;
+    /// @brief Creates a device that renders without a window or surface,
+    /// e.g. on a software implementation like lavapipe. Its swapchains
+    /// render to offscreen images of the given size.
+    static auto create_headless(uint32_t device_id, bool debug,
+                                vk::Extent2D extent) -> VulkanDevice;
 
     vk::raii::Device &operator*() { return m_device; }
     const vk::raii::Device &operator*() const { return m_device; }
@@ -56,11 +76,17 @@ public:
     const vk::raii::Device *operator->() const { return &m_device; }
 
     bool debug() const { return m_debug; }
+    bool headless() const { return !m_window; }
+    /// @brief True if BC1-7 compressed textures can be sampled.
+    bool texture_compression_bc() const { return m_texture_compression_bc; }
     const vk::raii::Context &context() const { return m_context; }
     const vk::raii::Instance &instance() const { return m_instance; }
     const vk::raii::PhysicalDevice &physical_device() const {
         return m_physical_device;
     }
+    vk::PresentModeKHR present_mode() const {
+        return m_swapchain_settings.present_mode;
+    }
     vk::raii::Queue &graphics_queue() { return m_graphics_queue; }
 
     vk::raii::Semaphore
@@ -76,16 +102,40 @@ public:
     }
 };
 
+/// @brief The parts of a replaced swapchain that frames still in flight
+/// may be using. Keep it alive until they finish.
+struct RetiredSwapchain {
+    vk::raii::DeviceMemory offscreen_memory;
+    std::vector<vk::raii::Image> offscreen_images;
+    vk::raii::SwapchainKHR swapchain;
+    std::vector<vk::raii::ImageView> image_views;
+    std::vector<vk::raii::Semaphore> present_semaphores;
+    uint64_t frame;
+};
+
+/// @brief The images frames are rendered to. On a headless device these
+/// are plain offscreen images, used round-robin, and there is nothing to
+/// acquire or present.
 class VulkanSwapchain {
     /// TODO: Should be shared_ptr when multithreading
     int m_width;
     int m_height;
+    bool m_out_of_date = false;
     const VulkanDevice &m_device;
+    // Only used when offscreen
+    vk::raii::DeviceMemory m_offscreen_memory{nullptr};
+    std::vector<vk::raii::Image> m_offscreen_images;
     vk::raii::SwapchainKHR m_swapchain;
     std::vector<vk::Image> m_images;
     std::vector<vk::raii::ImageView> m_image_views;
-    vk::raii::Semaphore m_image_available_semaphore;
+    // One per image: a present may still be waiting on the semaphore of
+    // an image until that image is acquired again
+    std::vector<vk::raii::Semaphore> m_present_semaphores;
     uint32_t m_acquired_image = 0xffffffff;
+    uint32_t m_next_offscreen_image = 0;
+
+    static auto create_offscreen(const VulkanDevice &device)
+        -> VulkanSwapchain;
 
 public:
     VulkanSwapchain(const VulkanDevice &device,
@@ -93,11 +143,20 @@ public:
                     std::vector<vk::Image> images,
                     std::vector<vk::raii::ImageView> image_views)
         : m_device{device}, m_swapchain(std::move(swapchain)),
-          m_images{std::move(images)}, m_image_views{std::move(image_views)},
-          m_image_available_semaphore{device.create_semaphore()} {}
+          m_images{std::move(images)}, m_image_views{std::move(image_views)} {
+        if (!offscreen()) {
+            for (size_t i = 0; i < m_images.size(); i++) {
+                m_present_semaphores.push_back(device.create_semaphore());
+            }
+        }
+    }
 
+    /// @brief `extent` is the window's drawable size, read on the main
+    /// thread; SDL video calls don't belong on the render thread. It is
+    /// ignored for a headless device.
     static auto create(const VulkanDevice &device,
-                       vk::SwapchainKHR old_swapchain) -> VulkanSwapchain;
+                       vk::SwapchainKHR old_swapchain, vk::Extent2D extent)
+        -> VulkanSwapchain;
 
     vk::raii::SwapchainKHR &operator*() { return m_swapchain; }
     const vk::raii::SwapchainKHR &operator*() const { return m_swapchain; }
@@ -107,10 +166,6 @@ public:
     int width() const { return m_width; }
     int height() const { return m_height; }
 
-    vk::raii::Semaphore &image_acquire_semaphore() {
-        return m_image_available_semaphore;
-    }
-
     vk::Image &current_image() {
         assert(m_acquired_image != 0xffffffff);
         return m_images[m_acquired_image];
@@ -119,15 +174,42 @@ public:
         assert(m_acquired_image != 0xffffffff);
         return m_image_views[m_acquired_image];
     }
+    /// @brief Semaphore to signal once the current image is rendered and
+    /// to wait on when presenting it. Not available offscreen.
+    vk::raii::Semaphore &current_present_semaphore() {
+        assert(m_acquired_image != 0xffffffff && !offscreen());
+        return m_present_semaphores[m_acquired_image];
+    }
     std::span<vk::Image> images() { return m_images; }
     uint32_t current_image_index() const { return m_acquired_image; }
     vk::Format image_format() const {
         return m_device.m_swapchain_settings.format;
     };
+    bool offscreen() const { return m_device.headless(); }
+    /// @brief Layout images must be in once a frame is done with them.
+    /// Offscreen images are left ready to be copied from.
+    vk::ImageLayout present_layout() const {
+        return offscreen() ? vk::ImageLayout::eTransferSrcOptimal
+                           : vk::ImageLayout::ePresentSrcKHR;
+    }
 
-    void acquire_next_image(uint64_t timeout);
-    void present(vk::raii::Queue &queue,
-                 std::span<const vk::Semaphore> wait_semaphores);
+    /// @brief True if the swapchain no longer matches the window and
+    /// should be recreated.
+    bool out_of_date() const { return m_out_of_date; }
+    void invalidate() { m_out_of_date = true; }
+    /// @brief Replaces the swapchain with one of size `extent`. The old
+    /// swapchain is passed to the driver as oldSwapchain and returned so
+    /// it can outlive frames in flight.
+    RetiredSwapchain recreate(vk::Extent2D extent);
+
+    /// @brief Returns false without acquiring an image if the swapchain
+    /// is out of date. `semaphore` is signaled once the image is ready;
+    /// it must not be pending from an earlier acquire. Offscreen images
+    /// don't signal it; don't wait on it.
+    bool acquire_next_image(uint64_t timeout, const vk::Semaphore &semaphore);
+    /// @brief Presents the current image once its present semaphore is
+    /// signaled. Does nothing for offscreen images.
+    void present(vk::raii::Queue &queue);
 };
 
 #endif
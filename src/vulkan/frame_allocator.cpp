@@ -0,0 +1,57 @@
+#include "vulkan/frame_allocator.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "exceptions.h"
+
+FrameAllocator
+FrameAllocator::create(std::shared_ptr<VulkanAllocator> allocator,
+                       vk::DeviceSize size) {
+    const auto limits =
+        allocator->device().physical_device().getProperties().limits;
+    const auto alignment = std::max({limits.minUniformBufferOffsetAlignment,
+                                     limits.minStorageBufferOffsetAlignment,
+                                     vk::DeviceSize{16}});
+
+    vk::BufferCreateInfo buffer_info;
+    buffer_info.size = size;
+    buffer_info.usage = vk::BufferUsageFlagBits::eUniformBuffer |
+                        vk::BufferUsageFlagBits::eStorageBuffer |
+                        vk::BufferUsageFlagBits::eIndirectBuffer |
+                        vk::BufferUsageFlagBits::eVertexBuffer |
+                        vk::BufferUsageFlagBits::eIndexBuffer;
+
+    VmaAllocationCreateInfo alloc_info;
+    memset(&alloc_info, 0, sizeof(VmaAllocationCreateInfo));
+    alloc_info.usage = VMA_MEMORY_USAGE_AUTO;
+    alloc_info.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT |
+                       VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+    auto buffer = VulkanAllocator::create_buffer(std::move(allocator),
+                                                 buffer_info, alloc_info);
+    return FrameAllocator(std::move(buffer), size, alignment);
+}
+
+FrameAllocation FrameAllocator::allocate(vk::DeviceSize size,
+                                         vk::DeviceSize alignment) {
+    // Alignments are powers of two
+    alignment = std::max(alignment, m_alignment);
+    const auto offset = (m_offset + alignment - 1) & ~(alignment - 1);
+    if (offset + size > m_size) {
+        throw OutOfMemoryException("Frame allocator out of memory");
+    }
+    m_offset = offset + size;
+
+    FrameAllocation allocation;
+    allocation.buffer = *m_buffer;
+    allocation.offset = offset;
+    allocation.size = size;
+    allocation.data = (char *)m_buffer.data() + offset;
+    return allocation;
+}
+
+void FrameAllocator::flush() {
+    if (m_offset > 0) {
+        m_buffer.flush(0, m_offset);
+    }
+}
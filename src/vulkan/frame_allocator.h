@@ -0,0 +1,65 @@
+#ifndef VULKAN_FRAME_ALLOCATOR_H_INCLUDED
+#define VULKAN_FRAME_ALLOCATOR_H_INCLUDED
+
+#include <memory>
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include "vulkan/memory.h"
+
+/// @brief A range of a frame allocator's buffer. Only valid until the
+/// allocator is reset.
+struct FrameAllocation {
+    vk::Buffer buffer;
+    vk::DeviceSize offset = 0;
+    vk::DeviceSize size = 0;
+    void *data = nullptr;
+
+    vk::DescriptorBufferInfo descriptor() const {
+        return vk::DescriptorBufferInfo{buffer, offset, size};
+    }
+};
+
+/// @brief Bump allocator over a persistently mapped buffer for data
+/// that only lives for one frame: uniforms, per-draw records, indirect
+/// commands, debug geometry, etc.
+///
+/// Each frame in flight owns one of these. It is reset once the frame's
+/// timeline value has been reached, so allocations never have to be
+/// freed individually.
+class FrameAllocator {
+    VulkanBuffer m_buffer;
+    vk::DeviceSize m_size;
+    vk::DeviceSize m_alignment;
+    vk::DeviceSize m_offset = 0;
+
+    FrameAllocator(VulkanBuffer buffer, vk::DeviceSize size,
+                   vk::DeviceSize alignment)
+        : m_buffer{std::move(buffer)}, m_size{size}, m_alignment{alignment} {}
+
+public:
+    static FrameAllocator create(std::shared_ptr<VulkanAllocator> allocator,
+                                 vk::DeviceSize size);
+
+    VulkanBuffer &buffer() { return m_buffer; }
+    const VulkanBuffer &buffer() const { return m_buffer; }
+    vk::DeviceSize size() const { return m_size; }
+    vk::DeviceSize used() const { return m_offset; }
+
+    /// @brief Allocates a range aligned to at least the device's
+    /// minimum uniform/storage buffer offset alignment.
+    FrameAllocation allocate(vk::DeviceSize size, vk::DeviceSize alignment = 1);
+
+    template<typename T>
+    T *allocate(FrameAllocation &allocation, size_t count = 1) {
+        allocation = allocate(sizeof(T) * count, alignof(T));
+        return static_cast<T *>(allocation.data);
+    }
+
+    /// @brief Makes everything written this frame visible to the
+    /// device. Must be called before submitting.
+    void flush();
+    void reset() { m_offset = 0; }
+};
+
+#endif
@@ -1,19 +1,114 @@
 #include "vulkan/memory.h"
 
+#include <cassert>
+#include <cstring>
+
+#include "exceptions.h"
+#include "vulkan/defragment.h"
 #include "vulkan/device.h"
 
+/// Returns the index of the largest device-local heap, which is where
+/// VRAM lives, or VK_MAX_MEMORY_HEAPS if there is none.
+static uint32_t
+largest_device_local_heap(const VkPhysicalDeviceMemoryProperties *props) {
+    uint32_t largest_heap = VK_MAX_MEMORY_HEAPS;
+    for (uint32_t i = 0; i < props->memoryHeapCount; i++) {
+        const auto &heap = props->memoryHeaps[i];
+        if (!(heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)) {
+            continue;
+        }
+        if (largest_heap == VK_MAX_MEMORY_HEAPS ||
+            heap.size > props->memoryHeaps[largest_heap].size) {
+            largest_heap = i;
+        }
+    }
+    return largest_heap;
+}
+
+/// Checks whether the largest device-local heap has a memory type that
+/// is also host-visible. Discrete GPUs without resizable BAR only
+/// expose a small (typically 256 MiB) host-visible window into VRAM,
+/// which we don't want to fill with meshes.
+static bool has_mappable_device_memory(VmaAllocator allocator) {
+    const VkPhysicalDeviceMemoryProperties *props;
+    vmaGetMemoryProperties(allocator, &props);
+    const auto largest_heap = largest_device_local_heap(props);
+    if (largest_heap == VK_MAX_MEMORY_HEAPS) {
+        return false;
+    }
+
+    const VkMemoryPropertyFlags required = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+                                           VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    for (uint32_t i = 0; i < props->memoryTypeCount; i++) {
+        const auto &type = props->memoryTypes[i];
+        if (type.heapIndex == largest_heap &&
+            (type.propertyFlags & required) == required) {
+            return true;
+        }
+    }
+    return false;
+}
+
 VulkanAllocator::VulkanAllocator(VulkanDevice &device,
                                  const VmaAllocatorCreateInfo &create_info)
     : m_device{device} {
     vmaCreateAllocator(&create_info, &m_allocator);
+    m_mappable_device_memory = has_mappable_device_memory(m_allocator);
+
+    // A pool is locked to a single memory type, so it must be one in
+    // the main VRAM heap. Otherwise the mesh pool could end up capped
+    // by a small BAR window.
+    VkBufferCreateInfo buffer_info = {VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+    buffer_info.size = 0x1'0000;
+    buffer_info.usage = static_cast<VkBufferUsageFlags>(MESH_BUFFER_USAGE);
+    VmaAllocationCreateInfo alloc_info = {};
+    alloc_info.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+    VmaPoolCreateInfo pool_info = {};
+    if (m_mappable_device_memory) {
+        alloc_info.flags =
+            VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+        const auto result = vmaFindMemoryTypeIndexForBufferInfo(
+            m_allocator, &buffer_info, &alloc_info, &pool_info.memoryTypeIndex);
+        const VkPhysicalDeviceMemoryProperties *props;
+        vmaGetMemoryProperties(m_allocator, &props);
+        if (result != VK_SUCCESS ||
+            props->memoryTypes[pool_info.memoryTypeIndex].heapIndex !=
+                largest_device_local_heap(props)) {
+            // Meshes then go through the staging buffer
+            m_mappable_device_memory = false;
+        }
+    }
+    if (!m_mappable_device_memory) {
+        alloc_info.flags = 0;
+        const auto result = vmaFindMemoryTypeIndexForBufferInfo(
+            m_allocator, &buffer_info, &alloc_info, &pool_info.memoryTypeIndex);
+        if (result != VK_SUCCESS) {
+            throw SystemException("No memory type suitable for meshes");
+        }
+    }
+    if (vmaCreatePool(m_allocator, &pool_info, &m_mesh_pool) != VK_SUCCESS) {
+        throw OutOfMemoryException("Failed to create mesh memory pool");
+    }
 }
 
 VulkanAllocator::~VulkanAllocator() {
+    if (m_mesh_pool) {
+        vmaDestroyPool(m_allocator, m_mesh_pool);
+    }
     if (m_allocator) {
         vmaDestroyAllocator(m_allocator);
     }
 }
 
+void VulkanAllocator::free(VmaAllocation allocation) {
+    // Allocations that are in the middle of being moved are freed by
+    // the defragmenter when the pass ends.
+    if (m_defragmenter && m_defragmenter->abandon(allocation)) {
+        return;
+    }
+    vmaFreeMemory(m_allocator, allocation);
+}
+
 VulkanBuffer VulkanAllocator::create_buffer(
     std::shared_ptr<VulkanAllocator> allocator,
     const vk::BufferCreateInfo &buffer_create_info,
@@ -29,6 +124,29 @@ VulkanBuffer VulkanAllocator::create_buffer(
                         std::move(buffer));
 }
 
+vk::Buffer VulkanAllocator::create_unmanaged_buffer(
+    const vk::BufferCreateInfo &buffer_create_info,
+    const VmaAllocationCreateInfo &alloc_create_info, VmaAllocation &allocation,
+    VmaAllocationInfo &info) {
+    VkBuffer buffer;
+    auto result = vmaCreateBuffer(
+        m_allocator, (VkBufferCreateInfo *)&buffer_create_info,
+        &alloc_create_info, &buffer, &allocation, &info);
+    if (result == VK_ERROR_OUT_OF_DEVICE_MEMORY) {
+        throw OutOfMemoryException("Out of device memory");
+    }
+    assert(result == VK_SUCCESS);
+    return buffer;
+}
+
+void VulkanAllocator::destroy_unmanaged_buffer(vk::Buffer buffer,
+                                               VmaAllocation allocation) {
+    // Destroys only the buffer; the memory may still be needed by the
+    // defragmenter.
+    vmaDestroyBuffer(m_allocator, buffer, VK_NULL_HANDLE);
+    free(allocation);
+}
+
 VulkanImage VulkanAllocator::create_image(
     std::shared_ptr<VulkanAllocator> allocator,
     const vk::ImageCreateInfo &image_create_info,
@@ -46,6 +164,24 @@ VulkanImage VulkanAllocator::create_image(
                        image_create_info.arrayLayers, image_create_info.format);
 }
 
+void VulkanAllocation::write(std::span<const char> data,
+                             vk::DeviceSize offset) {
+    assert(mapped());
+    assert(offset + data.size() <= size());
+    std::memcpy((char *)m_info.pMappedData + offset, data.data(), data.size());
+    flush(offset, data.size());
+}
+
+void VulkanAllocation::flush(vk::DeviceSize offset, vk::DeviceSize size) {
+    vmaFlushAllocation(m_allocator->m_allocator, m_allocation, offset, size);
+}
+
+void VulkanAllocation::invalidate(vk::DeviceSize offset,
+                                  vk::DeviceSize size) {
+    vmaInvalidateAllocation(m_allocator->m_allocator, m_allocation, offset,
+                            size);
+}
+
 vk::ImageAspectFlags all_aspects(vk::Format format) {
     switch (format) {
     case vk::Format::eD16Unorm:
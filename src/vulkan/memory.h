@@ -3,6 +3,7 @@
 
 #include <memory>
 #include <optional>
+#include <span>
 
 #include <vk_mem_alloc.h>
 #include <vulkan/vulkan_raii.hpp>
@@ -12,24 +13,52 @@
 class VulkanAllocation;
 class VulkanBuffer;
 class VulkanImage;
+class MeshDefragmenter;
+
+/// Usage flags of every buffer in the mesh pool. Meshes are copied
+/// around by the defragmenter, so they need to be transfer sources too.
+const vk::BufferUsageFlags MESH_BUFFER_USAGE =
+    vk::BufferUsageFlagBits::eVertexBuffer |
+    vk::BufferUsageFlagBits::eIndexBuffer |
+    vk::BufferUsageFlagBits::eTransferSrc |
+    vk::BufferUsageFlagBits::eTransferDst;
 
 // TODO: Buffer suballocation. VMA is quite stupid to not have that as a
 // feature.
 class VulkanAllocator {
     VulkanDevice &m_device;
     VmaAllocator m_allocator;
+    VmaPool m_mesh_pool = nullptr;
+    MeshDefragmenter *m_defragmenter = nullptr;
+    bool m_mappable_device_memory = false;
 
     friend class VulkanAllocation;
     friend class VulkanBuffer;
+    friend class MeshDefragmenter;
+
+    void free(VmaAllocation allocation);
 
 public:
     VulkanAllocator(VulkanDevice &device,
                     const VmaAllocatorCreateInfo &create_info);
     ~VulkanAllocator();
 
+    VmaAllocator operator*() const { return m_allocator; }
+
     VulkanDevice &device() { return m_device; }
     const VulkanDevice &device() const { return m_device; }
 
+    /// @brief True if the bulk of device-local memory can also be
+    /// mapped by the host, as on integrated GPUs and with resizable
+    /// BAR. Device-local resources can then be written directly
+    /// instead of going through a staging buffer.
+    bool mappable_device_memory() const { return m_mappable_device_memory; }
+
+    /// @brief Pool that all mesh buffers are allocated from. Keeping
+    /// meshes apart from other resources lets them be defragmented
+    /// without having to worry about textures or staging memory.
+    VmaPool mesh_pool() const { return m_mesh_pool; }
+
     static VulkanBuffer
     create_buffer(std::shared_ptr<VulkanAllocator> allocator,
                   const vk::BufferCreateInfo &buffer_create_info,
@@ -38,6 +67,16 @@ public:
     create_image(std::shared_ptr<VulkanAllocator> allocator,
                  const vk::ImageCreateInfo &image_create_info,
                  const VmaAllocationCreateInfo &allocation_create_info);
+
+    /// @brief Creates a buffer whose lifetime is managed by the caller
+    /// rather than by a VulkanBuffer. Used by resource tables that
+    /// destroy their contents in batches.
+    vk::Buffer
+    create_unmanaged_buffer(const vk::BufferCreateInfo &buffer_create_info,
+                            const VmaAllocationCreateInfo &alloc_create_info,
+                            VmaAllocation &allocation,
+                            VmaAllocationInfo &info);
+    void destroy_unmanaged_buffer(vk::Buffer buffer, VmaAllocation allocation);
 };
 
 class VulkanAllocation {
@@ -64,11 +103,14 @@ public:
     }
     ~VulkanAllocation() {
         if (m_allocation) {
-            vmaFreeMemory(m_allocator->m_allocator, m_allocation);
+            m_allocator->free(m_allocation);
         }
     }
 
     VulkanAllocation &operator=(VulkanAllocation &&other) {
+        if (m_allocation) {
+            m_allocator->free(m_allocation);
+        }
         m_allocator = std::move(other.m_allocator);
         m_allocation = other.m_allocation;
         other.m_allocation = 0;
@@ -82,6 +124,17 @@ public:
     vk::DeviceSize size() const { return m_info.size; }
     void *data() { return m_info.pMappedData; }
     const void *data() const { return m_info.pMappedData; }
+    bool mapped() const { return m_info.pMappedData != nullptr; }
+
+    /// @brief Copies data into a mapped allocation and flushes it so
+    /// it becomes visible to the device.
+    void write(std::span<const char> data, vk::DeviceSize offset);
+    /// @brief Flushes host writes to a mapped range. No-op on
+    /// host-coherent memory.
+    void flush(vk::DeviceSize offset, vk::DeviceSize size);
+    /// @brief Makes device writes to a mapped range visible to the
+    /// host. No-op on host-coherent memory.
+    void invalidate(vk::DeviceSize offset, vk::DeviceSize size);
 };
 
 class VulkanBuffer : public VulkanAllocation {
@@ -4,39 +4,155 @@
 
 #include "exceptions.h"
 
-VulkanBuffer create_buffer(std::shared_ptr<VulkanAllocator> allocator,
-                           vk::DeviceSize size, vk::BufferUsageFlagBits usage) {
+// Each mesh allocation's user data identifies the mesh and which of its
+// buffers the allocation backs
+static void *encode_user_data(Mesh mesh, bool index_buffer) {
+    return (void *)(((uintptr_t)mesh.bits() << 1) | index_buffer);
+}
+
+static std::pair<Mesh, bool> decode_user_data(void *user_data) {
+    const auto bits = (uintptr_t)user_data;
+    return {Mesh::from_bits(bits >> 1), bits & 1};
+}
+
+static vk::Buffer create_buffer(VulkanAllocator &allocator,
+                                vk::DeviceSize size, VmaAllocation &allocation,
+                                void *&mapped) {
     const uint32_t index = 0;
     vk::BufferCreateInfo buf_info;
     buf_info.size = size;
-    buf_info.usage = usage | vk::BufferUsageFlagBits::eTransferDst;
+    buf_info.usage = MESH_BUFFER_USAGE;
     buf_info.setQueueFamilyIndices(index);
     VmaAllocationCreateInfo alloc_info;
     memset(&alloc_info, 0, sizeof(VmaAllocationCreateInfo));
-    alloc_info.usage = VmaMemoryUsage::VMA_MEMORY_USAGE_AUTO;
-    return VulkanAllocator::create_buffer(allocator, buf_info, alloc_info);
-}
-
-Mesh::Mesh(std::shared_ptr<VulkanAllocator> allocator, StagingBuffer &staging,
-           std::span<const char> vertex_data,
-           std::span<const uint32_t> index_data)
-    : m_vertex_buffer{create_buffer(allocator, vertex_data.size(),
-                                    vk::BufferUsageFlagBits::eVertexBuffer)},
-      m_index_buffer{create_buffer(allocator,
-                                   sizeof(uint32_t) * index_data.size(),
-                                   vk::BufferUsageFlagBits::eIndexBuffer)},
-      m_size{index_data.size()} {
+    alloc_info.pool = allocator.mesh_pool();
+    if (allocator.mappable_device_memory()) {
+        // The mesh pool lives in host-visible device memory, so the
+        // data can be written straight into it.
+        alloc_info.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+    }
+    VmaAllocationInfo info;
+    auto buffer = allocator.create_unmanaged_buffer(buf_info, alloc_info,
+                                                    allocation, info);
+    mapped = info.pMappedData;
+    return buffer;
+}
+
+void GpuMesh::bind(vk::raii::CommandBuffer &cmds) const {
+    const vk::DeviceSize offset = 0;
+    cmds.bindVertexBuffers2(0, vertex_buffer, offset, vertex_size, nullptr);
+    cmds.bindIndexBuffer(index_buffer, 0, vk::IndexType::eUint32);
+}
+
+MeshRegistry::~MeshRegistry() {
+    for (const auto &[frame, mesh] : m_garbage) {
+        free(mesh);
+    }
+    for (const auto &mesh : m_meshes.values()) {
+        free(mesh);
+    }
+}
+
+void MeshRegistry::free(const GpuMesh &mesh) {
+    m_allocator->destroy_unmanaged_buffer(mesh.vertex_buffer,
+                                          mesh.vertex_allocation);
+    m_allocator->destroy_unmanaged_buffer(mesh.index_buffer,
+                                          mesh.index_allocation);
+}
+
+Mesh MeshRegistry::create(StagingBuffer &staging,
+                          std::span<const char> vertex_data,
+                          std::span<const uint32_t> index_data) {
     const auto index_bytes = as_bytes(index_data);
-    if (vertex_data.size() + index_bytes.size() > staging.remaining()) {
+
+    GpuMesh mesh;
+    mesh.vertex_size = vertex_data.size();
+    mesh.size = index_data.size();
+    void *vertex_mapped, *index_mapped;
+    mesh.vertex_buffer =
+        create_buffer(*m_allocator, vertex_data.size(), mesh.vertex_allocation,
+                      vertex_mapped);
+    try {
+        mesh.index_buffer = create_buffer(*m_allocator, index_bytes.size(),
+                                          mesh.index_allocation, index_mapped);
+    } catch (...) {
+        m_allocator->destroy_unmanaged_buffer(mesh.vertex_buffer,
+                                              mesh.vertex_allocation);
+        throw;
+    }
+
+    // Write straight into device memory when it is mapped. The buffers
+    // are brand new, so the device can't be using them yet.
+    vk::DeviceSize staged_size = 0;
+    if (!vertex_mapped) {
+        staged_size += vertex_data.size();
+    }
+    if (!index_mapped) {
+        staged_size += index_bytes.size();
+    }
+    if (staged_size > staging.remaining()) {
+        free(mesh);
         throw OutOfMemoryException("Staging buffer full");
     }
-    staging.stage_buffer(vertex_data, m_vertex_buffer, 0);
-    m_upload_batch = staging.stage_buffer(index_bytes, m_index_buffer, 0);
+
+    auto &allocator = **m_allocator;
+    if (vertex_mapped) {
+        memcpy(vertex_mapped, vertex_data.data(), vertex_data.size());
+        vmaFlushAllocation(allocator, mesh.vertex_allocation, 0,
+                           vertex_data.size());
+    } else {
+        mesh.upload_batch =
+            staging.stage_buffer(vertex_data, mesh.vertex_buffer, 0);
+    }
+    if (index_mapped) {
+        memcpy(index_mapped, index_bytes.data(), index_bytes.size());
+        vmaFlushAllocation(allocator, mesh.index_allocation, 0,
+                           index_bytes.size());
+    } else {
+        mesh.upload_batch =
+            staging.stage_buffer(index_bytes, mesh.index_buffer, 0);
+    }
+    if (staged_size == 0) {
+        mesh.upload_batch = 0;
+    }
+
+    const auto vertex_allocation = mesh.vertex_allocation;
+    const auto index_allocation = mesh.index_allocation;
+    const auto handle = m_meshes.insert(mesh);
+    vmaSetAllocationUserData(allocator, vertex_allocation,
+                             encode_user_data(handle, false));
+    vmaSetAllocationUserData(allocator, index_allocation,
+                             encode_user_data(handle, true));
+    return handle;
 }
 
-void Mesh::bind(vk::raii::CommandBuffer &cmds) const {
-    const vk::DeviceSize offset = 0;
-    const vk::DeviceSize size = m_vertex_buffer.size();
-    cmds.bindVertexBuffers2(0, *m_vertex_buffer, offset, size, nullptr);
-    cmds.bindIndexBuffer(*m_index_buffer, 0, vk::IndexType::eUint32);
+void MeshRegistry::destroy(Mesh mesh, uint64_t frame) {
+    m_garbage.push_back({frame, m_meshes.remove(mesh)});
+}
+
+void MeshRegistry::collect_garbage(uint64_t completed_frame) {
+    auto it = m_garbage.begin();
+    while (it != m_garbage.end()) {
+        if (it->first <= completed_frame) {
+            free(it->second);
+            *it = std::move(m_garbage.back());
+            m_garbage.pop_back();
+        } else {
+            it++;
+        }
+    }
+}
+
+MeshBuffer MeshRegistry::find_buffer(VmaAllocation allocation) {
+    VmaAllocationInfo info;
+    vmaGetAllocationInfo(**m_allocator, allocation, &info);
+    const auto [handle, index_buffer] = decode_user_data(info.pUserData);
+    auto *mesh = m_meshes.get(handle);
+    if (!mesh) {
+        return {};
+    }
+    if (index_buffer) {
+        return {&mesh->index_buffer, sizeof(uint32_t) * mesh->size};
+    }
+    return {&mesh->vertex_buffer, mesh->vertex_size};
 }
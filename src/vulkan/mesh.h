@@ -1,31 +1,76 @@
 #ifndef VULKAN_MESH_H_INCLUDED
 #define VULKAN_MESH_H_INCLUDED
 
-#include <optional>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
 
 #include "vulkan/memory.h"
+#include "vulkan/registry.h"
 #include "vulkan/staging.h"
 
-class Mesh {
-    VulkanBuffer m_vertex_buffer;
-    VulkanBuffer m_index_buffer;
+/// @brief Device-side state of a mesh. Plain handles only; the
+/// MeshRegistry owns the underlying objects.
+struct GpuMesh {
+    vk::Buffer vertex_buffer;
+    vk::Buffer index_buffer;
+    VmaAllocation vertex_allocation = nullptr;
+    VmaAllocation index_allocation = nullptr;
+    vk::DeviceSize vertex_size = 0;
 
     // Size is the size of the index buffer
-    uint32_t m_size = 0;
-    uint64_t m_upload_batch = ~0;
+    uint32_t size = 0;
+    // Staging batch the mesh is uploaded in, or 0 if it was written
+    // directly into mapped device memory
+    uint64_t upload_batch = ~0;
+
+    void bind(vk::raii::CommandBuffer &cmds) const;
+};
+
+typedef Handle<GpuMesh> Mesh;
+
+/// @brief Buffer of a mesh as seen by the defragmenter.
+struct MeshBuffer {
+    vk::Buffer *buffer = nullptr;
+    vk::DeviceSize size = 0;
+};
+
+/// @brief Owns every mesh on the device.
+///
+/// Meshes are referred to by handle. Destruction is deferred until the
+/// frames that may be drawing the mesh have completed and then done in
+/// one batch.
+class MeshRegistry {
+    std::shared_ptr<VulkanAllocator> m_allocator;
+    ResourceTable<GpuMesh> m_meshes;
+    // Destroyed meshes along with the frame after which they are unused
+    std::vector<std::pair<uint64_t, GpuMesh>> m_garbage;
+
+    void free(const GpuMesh &mesh);
 
 public:
-    Mesh(std::shared_ptr<VulkanAllocator> allocator, StagingBuffer &staging,
-         std::span<const char> vertex_data,
-         std::span<const uint32_t> index_data);
-    Mesh(Mesh &&other) = default;
-    Mesh(const Mesh &other) = delete;
+    MeshRegistry(std::shared_ptr<VulkanAllocator> allocator)
+        : m_allocator{std::move(allocator)} {}
+    MeshRegistry(const MeshRegistry &other) = delete;
+    MeshRegistry &operator=(const MeshRegistry &other) = delete;
+    /// Must only be destroyed once the device is idle.
+    ~MeshRegistry();
 
-    Mesh &operator=(Mesh &&other) = default;
-    Mesh &operator=(const Mesh &other) = delete;
+    Mesh create(StagingBuffer &staging, std::span<const char> vertex_data,
+                std::span<const uint32_t> index_data);
+    /// @brief Invalidates the handle immediately. The buffers are
+    /// released once `frame` has completed.
+    void destroy(Mesh mesh, uint64_t frame);
+    void collect_garbage(uint64_t completed_frame);
 
-    uint32_t size() const { return m_size; }
-    void bind(vk::raii::CommandBuffer &cmds) const;
+    GpuMesh *get(Mesh mesh) { return m_meshes.get(mesh); }
+    const GpuMesh *get(Mesh mesh) const { return m_meshes.get(mesh); }
+    std::span<const GpuMesh> resident() const { return m_meshes.values(); }
+
+    /// @brief Finds the mesh buffer backed by an allocation in the mesh
+    /// pool. Returns a null buffer if the mesh has been destroyed.
+    MeshBuffer find_buffer(VmaAllocation allocation);
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,217 @@
+#include <array>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include "exceptions.h"
+#include "vulkan/pipeline.h"
+
+static PipelineCacheHeader make_header(const VulkanDevice &device) {
+    const auto properties = device.physical_device().getProperties();
+    PipelineCacheHeader header;
+    memcpy(header.magic, PIPELINE_CACHE_MAGIC, sizeof(PIPELINE_CACHE_MAGIC));
+    header.version = PIPELINE_CACHE_VERSION;
+    header.vendor_id = properties.vendorID;
+    header.device_id = properties.deviceID;
+    header.driver_version = properties.driverVersion;
+    memcpy(header.uuid, properties.pipelineCacheUUID, VK_UUID_SIZE);
+    header.data_size = 0;
+    return header;
+}
+
+// Returns the cache data stored in the file, or nothing if the file is
+// missing or was written for a different device or driver
+static std::vector<char> read_cache_file(const VulkanDevice &device,
+                                         const std::string &path) {
+    std::ifstream f(path, std::ios_base::binary);
+    if (!f.good()) {
+        return {};
+    }
+    PipelineCacheHeader header;
+    if (!f.read((char *)&header, sizeof(header))) {
+        return {};
+    }
+    auto expected = make_header(device);
+    expected.data_size = header.data_size;
+    if (memcmp(&header, &expected, sizeof(header))) {
+        return {};
+    }
+    // A corrupted size would otherwise make the allocation below throw
+    std::error_code error;
+    const auto file_size = std::filesystem::file_size(path, error);
+    if (error || header.data_size > file_size - sizeof(header)) {
+        return {};
+    }
+    std::vector<char> data(header.data_size);
+    if (!f.read(data.data(), data.size())) {
+        return {};
+    }
+    return data;
+}
+
+PipelineCache PipelineCache::create(const VulkanDevice &device,
+                                    std::string path) {
+    std::vector<char> data;
+    if (!path.empty()) {
+        data = read_cache_file(device, path);
+    }
+    vk::PipelineCacheCreateInfo info;
+    info.initialDataSize = data.size();
+    info.pInitialData = data.data();
+    auto cache = device->createPipelineCache(info, nullptr);
+    device.set_name(*cache, "PipelineCache");
+    return PipelineCache(device, std::move(path), std::move(cache));
+}
+
+void PipelineCache::save() const {
+    if (m_path.empty()) {
+        return;
+    }
+    const auto data = m_cache.getData();
+    auto header = make_header(*m_device);
+    header.data_size = data.size();
+
+    // Write to a temporary file first so a crash never leaves a
+    // truncated cache behind
+    const std::filesystem::path path{m_path};
+    const auto temp_path = path.string() + ".tmp";
+    std::error_code error;
+    if (path.has_parent_path()) {
+        std::filesystem::create_directories(path.parent_path(), error);
+    }
+    {
+        std::ofstream f(temp_path, std::ios_base::binary);
+        f.write((const char *)&header, sizeof(header));
+        f.write((const char *)data.data(), data.size());
+        if (!f.good()) {
+            throw SystemException("Cannot write file: " + temp_path);
+        }
+    }
+    std::filesystem::rename(temp_path, path, error);
+    if (error) {
+        throw SystemException("Cannot write file: " + m_path);
+    }
+}
+
+vk::raii::Pipeline
+GraphicsPipelineDesc::build(const VulkanDevice &device,
+                            const PipelineCache &cache) const {
+    vk::PipelineVertexInputStateCreateInfo vertex_input;
+    vertex_input.setVertexAttributeDescriptions(attributes);
+    vertex_input.setVertexBindingDescriptions(bindings);
+
+    vk::PipelineInputAssemblyStateCreateInfo input_assembly;
+    input_assembly.topology = topology;
+
+    vk::PipelineViewportStateCreateInfo viewport_state;
+    viewport_state.viewportCount = 1;
+    viewport_state.scissorCount = 1;
+    std::array<vk::DynamicState, 2> dynamic_states = {
+        vk::DynamicState::eViewport,
+        vk::DynamicState::eScissor,
+    };
+    vk::PipelineDynamicStateCreateInfo dynamic_state;
+    dynamic_state.setDynamicStates(dynamic_states);
+
+    vk::PipelineRasterizationStateCreateInfo raster_state;
+    raster_state.polygonMode = vk::PolygonMode::eFill;
+    raster_state.cullMode = cull_mode;
+    raster_state.frontFace = vk::FrontFace::eCounterClockwise;
+    raster_state.lineWidth = 1.0;
+
+    vk::PipelineMultisampleStateCreateInfo multisample_state;
+    multisample_state.rasterizationSamples = vk::SampleCountFlagBits::e1;
+
+    vk::PipelineDepthStencilStateCreateInfo depth_state;
+    depth_state.depthTestEnable = depth_test;
+    depth_state.depthWriteEnable = depth_write;
+    depth_state.depthCompareOp = depth_compare;
+
+    vk::PipelineColorBlendAttachmentState attachment;
+    attachment.colorWriteMask =
+        vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
+        vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
+    vk::PipelineColorBlendStateCreateInfo color_blend;
+    color_blend.setAttachments(attachment);
+
+    vk::PipelineRenderingCreateInfo rendering_info;
+    rendering_info.setColorAttachmentFormats(color_format);
+    rendering_info.depthAttachmentFormat = depth_format;
+
+    vk::GraphicsPipelineCreateInfo info;
+    info.pNext = &rendering_info;
+    info.setStages(stages);
+    info.pVertexInputState = &vertex_input;
+    info.pInputAssemblyState = &input_assembly;
+    info.pViewportState = &viewport_state;
+    info.pRasterizationState = &raster_state;
+    info.pMultisampleState = &multisample_state;
+    info.pDepthStencilState = &depth_state;
+    info.pColorBlendState = &color_blend;
+    info.pDynamicState = &dynamic_state;
+    info.layout = layout;
+
+    auto pipeline = device->createGraphicsPipeline(*cache, info, nullptr);
+    if (!name.empty()) {
+        device.set_name(*pipeline, name.c_str());
+    }
+    return pipeline;
+}
+
+PipelineCompiler::PipelineCompiler(const VulkanDevice &device,
+                                   const PipelineCache &cache,
+                                   size_t thread_count)
+    : m_device{device}, m_cache{cache} {
+    for (size_t i = 0; i < thread_count; i++) {
+        m_threads.emplace_back([this]() { work(); });
+    }
+}
+
+PipelineCompiler::~PipelineCompiler() {
+    {
+        std::lock_guard lock{m_mutex};
+        m_stopping = true;
+    }
+    m_condition.notify_all();
+    for (auto &thread : m_threads) {
+        thread.join();
+    }
+}
+
+PipelineHandle PipelineCompiler::submit(GraphicsPipelineDesc desc) {
+    Job job;
+    job.desc = std::move(desc);
+    auto future = job.promise.get_future().share();
+    {
+        std::lock_guard lock{m_mutex};
+        m_queue.push_back(std::move(job));
+    }
+    m_condition.notify_one();
+    return PipelineHandle{std::move(future)};
+}
+
+void PipelineCompiler::work() {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock lock{m_mutex};
+            m_condition.wait(
+                lock, [this]() { return m_stopping || !m_queue.empty(); });
+            if (m_stopping) {
+                return;
+            }
+            job = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+
+        try {
+            auto pipeline = job.desc.build(m_device, m_cache);
+            job.promise.set_value(
+                std::make_shared<vk::raii::Pipeline>(std::move(pipeline)));
+        } catch (...) {
+            job.promise.set_exception(std::current_exception());
+        }
+    }
+}
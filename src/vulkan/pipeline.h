@@ -1,6 +1,148 @@
 #ifndef VULKAN_PIPELINE_H_INCLUDED
 #define VULKAN_PIPELINE_H_INCLUDED
 
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "vulkan/device.h"
+
 class PipelineKey {};
 
-#endif
\ No newline at end of file
+// Pipeline cache file layout:
+//
+//   PipelineCacheHeader
+//   data_size bytes of vkGetPipelineCacheData output
+//
+// The driver's own blob header doesn't include the driver version, and
+// some drivers misbehave when handed stale data, so the file is only
+// used if everything in our header matches the current device.
+
+const char PIPELINE_CACHE_MAGIC[8] = {'E', 'N', 'G', 'Y', 'P', 'S', 'O', 0};
+const uint32_t PIPELINE_CACHE_VERSION = 1;
+
+struct PipelineCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t vendor_id;
+    uint32_t device_id;
+    uint32_t driver_version;
+    uint8_t uuid[VK_UUID_SIZE];
+    uint64_t data_size;
+};
+
+static_assert(sizeof(PipelineCacheHeader) == 48);
+
+const size_t PIPELINE_COMPILER_THREADS = 2;
+
+/// @brief A pipeline cache that persists across runs.
+class PipelineCache {
+    const VulkanDevice *m_device;
+    std::string m_path;
+    vk::raii::PipelineCache m_cache;
+
+    PipelineCache(const VulkanDevice &device, std::string path,
+                  vk::raii::PipelineCache cache)
+        : m_device{&device}, m_path{std::move(path)},
+          m_cache{std::move(cache)} {}
+
+public:
+    /// @brief Creates the cache, seeded from the file at `path` if it
+    /// exists and was written for the same device and driver. An empty
+    /// path disables persistence.
+    static PipelineCache create(const VulkanDevice &device, std::string path);
+
+    const vk::raii::PipelineCache &operator*() const { return m_cache; }
+
+    const std::string &path() const { return m_path; }
+    /// @brief Writes the cache contents back to its file.
+    void save() const;
+};
+
+/// @brief Fixed-function state and shaders of a graphics pipeline. Owns
+/// everything the create info points at, so it can be built on another
+/// thread. Shader modules and the layout must outlive the build.
+/// Viewport and scissor are dynamic so pipelines survive resizes.
+struct GraphicsPipelineDesc {
+    std::string name;
+    std::vector<vk::PipelineShaderStageCreateInfo> stages;
+    std::vector<vk::VertexInputAttributeDescription> attributes;
+    std::vector<vk::VertexInputBindingDescription> bindings;
+    vk::PrimitiveTopology topology = vk::PrimitiveTopology::eTriangleList;
+    vk::CullModeFlags cull_mode = vk::CullModeFlagBits::eBack;
+    bool depth_test = true;
+    bool depth_write = true;
+    vk::CompareOp depth_compare = vk::CompareOp::eGreater;
+    vk::Format color_format;
+    vk::Format depth_format = vk::Format::eD32Sfloat;
+    vk::PipelineLayout layout;
+
+    vk::raii::Pipeline build(const VulkanDevice &device,
+                             const PipelineCache &cache) const;
+};
+
+typedef std::shared_future<std::shared_ptr<vk::raii::Pipeline>>
+    PipelineFuture;
+
+/// @brief A pipeline that may still be compiling.
+class PipelineHandle {
+    PipelineFuture m_future;
+
+public:
+    PipelineHandle() = default;
+    PipelineHandle(PipelineFuture future) : m_future{std::move(future)} {}
+
+    bool ready() const {
+        return m_future.valid() &&
+               m_future.wait_for(std::chrono::seconds(0)) ==
+                   std::future_status::ready;
+    }
+    /// @brief Blocks until compilation finishes or fails.
+    void wait() const {
+        if (m_future.valid()) {
+            m_future.wait();
+        }
+    }
+    /// @brief Returns the pipeline, or a null handle if it isn't ready
+    /// yet. Rethrows the error if compilation failed.
+    vk::Pipeline get() const { return ready() ? **m_future.get() : nullptr; }
+};
+
+/// @brief Compiles graphics pipelines on worker threads so the caller
+/// never stalls on the driver's shader compiler.
+class PipelineCompiler {
+    struct Job {
+        GraphicsPipelineDesc desc;
+        std::promise<std::shared_ptr<vk::raii::Pipeline>> promise;
+    };
+
+    const VulkanDevice &m_device;
+    const PipelineCache &m_cache;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::deque<Job> m_queue;
+    bool m_stopping = false;
+    std::vector<std::thread> m_threads;
+
+    void work();
+
+public:
+    PipelineCompiler(const VulkanDevice &device, const PipelineCache &cache,
+                     size_t thread_count = PIPELINE_COMPILER_THREADS);
+    PipelineCompiler(const PipelineCompiler &other) = delete;
+    PipelineCompiler &operator=(const PipelineCompiler &other) = delete;
+    /// Waits for pipelines being compiled. Queued pipelines are
+    /// abandoned; their handles report a broken promise.
+    ~PipelineCompiler();
+
+    /// @brief Queues a pipeline for compilation and returns immediately.
+    PipelineHandle submit(GraphicsPipelineDesc desc);
+};
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef VULKAN_REGISTRY_H_INCLUDED
+#define VULKAN_REGISTRY_H_INCLUDED
+
+#include <cassert>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+/// @brief 32-bit generational handle into a ResourceTable<T>.
+///
+/// The low bits index a slot and the high bits hold the slot's
+/// generation, so a handle to a destroyed resource is detected rather
+/// than aliasing whatever reused the slot. The zero handle is null.
+template<typename T>
+class Handle {
+    uint32_t m_bits = 0;
+
+public:
+    static constexpr uint32_t INDEX_BITS = 20;
+    static constexpr uint32_t INDEX_MASK = (1u << INDEX_BITS) - 1;
+    static constexpr uint32_t MAX_GENERATION = (1u << (32 - INDEX_BITS)) - 1;
+
+    Handle() = default;
+    Handle(uint32_t index, uint32_t generation)
+        : m_bits{(generation << INDEX_BITS) | index} {
+        assert(index <= INDEX_MASK && generation <= MAX_GENERATION);
+    }
+
+    static Handle from_bits(uint32_t bits) {
+        Handle handle;
+        handle.m_bits = bits;
+        return handle;
+    }
+
+    uint32_t bits() const { return m_bits; }
+    uint32_t index() const { return m_bits & INDEX_MASK; }
+    uint32_t generation() const { return m_bits >> INDEX_BITS; }
+
+    explicit operator bool() const { return m_bits != 0; }
+    bool operator==(const Handle &other) const = default;
+};
+
+/// @brief Dense table of resources addressed by generational handles.
+///
+/// Values are stored contiguously so iterating over every live
+/// resource is a linear scan. Removal swaps the last value into the
+/// hole, and a sparse slot array maps handles to dense positions.
+template<typename T>
+class ResourceTable {
+    struct Slot {
+        uint32_t dense;
+        // Generations start at 1 so that no live handle is null
+        uint32_t generation = 1;
+    };
+
+    std::vector<T> m_values;
+    // Slot index of each dense value
+    std::vector<uint32_t> m_owners;
+    std::vector<Slot> m_slots;
+    std::vector<uint32_t> m_free_slots;
+
+public:
+    ResourceTable() = default;
+
+    size_t size() const { return m_values.size(); }
+    bool empty() const { return m_values.empty(); }
+    std::span<T> values() { return m_values; }
+    std::span<const T> values() const { return m_values; }
+
+    Handle<T> insert(T value) {
+        uint32_t slot;
+        if (!m_free_slots.empty()) {
+            slot = m_free_slots.back();
+            m_free_slots.pop_back();
+        } else {
+            slot = m_slots.size();
+            assert(slot <= Handle<T>::INDEX_MASK);
+            m_slots.push_back({});
+        }
+        m_slots[slot].dense = m_values.size();
+        m_values.push_back(std::move(value));
+        m_owners.push_back(slot);
+        return {slot, m_slots[slot].generation};
+    }
+
+    bool contains(Handle<T> handle) const {
+        return handle && handle.index() < m_slots.size() &&
+               m_slots[handle.index()].generation == handle.generation();
+    }
+
+    T *get(Handle<T> handle) {
+        return contains(handle) ? &m_values[m_slots[handle.index()].dense]
+                                : nullptr;
+    }
+    const T *get(Handle<T> handle) const {
+        return contains(handle) ? &m_values[m_slots[handle.index()].dense]
+                                : nullptr;
+    }
+
+    /// @brief Removes the value and invalidates the handle. The handle
+    /// must be valid.
+    T remove(Handle<T> handle) {
+        assert(contains(handle));
+        auto &slot = m_slots[handle.index()];
+        const auto dense = slot.dense;
+        T value = std::move(m_values[dense]);
+
+        const auto last = m_values.size() - 1;
+        if (dense != last) {
+            m_values[dense] = std::move(m_values[last]);
+            m_owners[dense] = m_owners[last];
+            m_slots[m_owners[dense]].dense = dense;
+        }
+        m_values.pop_back();
+        m_owners.pop_back();
+
+        slot.generation = slot.generation == Handle<T>::MAX_GENERATION
+                              ? 1
+                              : slot.generation + 1;
+        m_free_slots.push_back(handle.index());
+        return value;
+    }
+};
+
+#endif
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <array>
 #include <format>
 #include <memory>
@@ -11,20 +12,10 @@
 #include "math/vector.h"
 #include "vulkan/memory.h"
 #include "vulkan/renderer.h"
+#include "vulkan/shaders.h"
 
-VulkanBuffer create_uniforms(std::shared_ptr<VulkanAllocator> allocator) {
-    vk::BufferCreateInfo buffer_info;
-    buffer_info.size = sizeof(Uniforms);
-    buffer_info.usage = vk::BufferUsageFlagBits::eUniformBuffer;
-
-    VmaAllocationCreateInfo alloc_info;
-    memset(&alloc_info, 0, sizeof(VmaAllocationCreateInfo));
-    alloc_info.usage = VMA_MEMORY_USAGE_AUTO;
-    alloc_info.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT |
-                       VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
-    return VulkanAllocator::create_buffer(std::move(allocator), buffer_info,
-                                          alloc_info);
-}
+// Plenty for uniforms and per-draw data of a few thousand draws
+const vk::DeviceSize FRAME_ALLOCATOR_SIZE = 0x10'0000;
 
 VulkanImage create_depth_buffer(const VulkanSwapchain &swapchain,
                                 std::shared_ptr<VulkanAllocator> allocator) {
@@ -50,6 +41,7 @@ PerFrame PerFrame::create(int index, VulkanDevice &device,
                           const VulkanSwapchain &swapchain,
                           std::shared_ptr<VulkanAllocator> allocator) {
     auto semaphore = device.create_semaphore(vk::SemaphoreType::eTimeline);
+    auto acquire_semaphore = device.create_semaphore();
 
     vk::CommandPoolCreateInfo cmd_info;
     cmd_info.flags = vk::CommandPoolCreateFlagBits::eTransient;
@@ -64,46 +56,54 @@ PerFrame PerFrame::create(int index, VulkanDevice &device,
     auto &buffer = buffers[0];
 
     auto depth_buffer = create_depth_buffer(swapchain, allocator);
-    auto uniforms = create_uniforms(std::move(allocator));
+    auto frame_allocator =
+        FrameAllocator::create(std::move(allocator), FRAME_ALLOCATOR_SIZE);
 
     if (device.debug()) {
         std::string name;
         name = std::format("PerFrame[{}].end_of_frame_semaphore", index);
         device.set_name(*semaphore, name.c_str());
+        name = std::format("PerFrame[{}].image_acquire_semaphore", index);
+        device.set_name(*acquire_semaphore, name.c_str());
         name = std::format("PerFrame[{}].command_pool", index);
         device.set_name(*pool, name.c_str());
         name = std::format("PerFrame[{}].command_buffer", index);
         device.set_name(*buffer, name.c_str());
-        name = std::format("PerFrame[{}].uniforms", index);
-        device.set_name(*uniforms, name.c_str());
+        name = std::format("PerFrame[{}].allocator", index);
+        device.set_name(*frame_allocator.buffer(), name.c_str());
     }
 
-    return {std::move(semaphore), std::move(pool), std::move(buffer),
-            std::move(depth_buffer), std::move(uniforms)};
+    return {std::move(semaphore), std::move(acquire_semaphore),
+            std::move(pool), std::move(buffer), std::move(depth_buffer),
+            std::move(frame_allocator)};
 }
 
 vk::raii::ShaderModule &
-VulkanRenderer::create_shader_module(std::span<const char> bytes) {
-    assert(bytes.size() % 4 == 0);
-    const std::span<const uint32_t> code2{(const uint32_t *)&bytes[0],
-                                          bytes.size() / 4};
+VulkanRenderer::create_shader_module(std::span<const uint32_t> code) {
     vk::ShaderModuleCreateInfo info;
-    info.setCode(code2);
+    info.setCode(code);
     auto module = m_device->createShaderModule(info, nullptr);
     m_shaders.push_back(std::move(module));
     return m_shaders[m_shaders.size() - 1];
 }
 
 vk::raii::DescriptorSetLayout &VulkanRenderer::create_set_layout() {
-    vk::DescriptorSetLayoutBinding binding;
-    binding.binding = 0;
-    binding.descriptorType = vk::DescriptorType::eUniformBuffer;
-    binding.descriptorCount = 1;
-    binding.stageFlags =
+    vk::DescriptorSetLayoutBinding view_binding;
+    view_binding.binding = 0;
+    view_binding.descriptorType = vk::DescriptorType::eUniformBuffer;
+    view_binding.descriptorCount = 1;
+    view_binding.stageFlags =
         vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment;
+    vk::DescriptorSetLayoutBinding instance_binding;
+    instance_binding.binding = 1;
+    instance_binding.descriptorType = vk::DescriptorType::eUniformBuffer;
+    instance_binding.descriptorCount = 1;
+    instance_binding.stageFlags = vk::ShaderStageFlagBits::eVertex;
+    std::array<vk::DescriptorSetLayoutBinding, 2> bindings = {
+        view_binding, instance_binding};
     vk::DescriptorSetLayoutCreateInfo info;
     info.flags = vk::DescriptorSetLayoutCreateFlagBits::ePushDescriptorKHR;
-    info.setBindings(binding);
+    info.setBindings(bindings);
     auto layout = m_device->createDescriptorSetLayout(info, nullptr);
     m_set_layouts.push_back(std::move(layout));
     return m_set_layouts[0];
@@ -122,22 +122,22 @@ vk::raii::PipelineLayout &VulkanRenderer::create_pipeline_layout() {
     return m_pipeline_layouts[m_pipeline_layouts.size() - 1];
 }
 
-vk::raii::Pipeline &VulkanRenderer::create_graphics_pipeline(AssetApi &assets) {
-    std::vector<vk::PipelineShaderStageCreateInfo> stages;
-    auto &vertex_shader =
-        create_shader_module(assets.load_blob("shaders/chunk.vertex.spv"));
+PipelineHandle VulkanRenderer::create_graphics_pipeline() {
+    GraphicsPipelineDesc desc;
+    desc.name = "Renderer.m_graphics_pipelines[0]";
+
+    auto &vertex_shader = create_shader_module(CHUNK_VERTEX_SPV);
     vk::PipelineShaderStageCreateInfo vertex_stage;
     vertex_stage.stage = vk::ShaderStageFlagBits::eVertex;
     vertex_stage.module = *vertex_shader;
     vertex_stage.pName = "main";
-    stages.push_back(vertex_stage);
-    auto &fragment_shader =
-        create_shader_module(assets.load_blob("shaders/chunk.fragment.spv"));
+    desc.stages.push_back(vertex_stage);
+    auto &fragment_shader = create_shader_module(CHUNK_FRAGMENT_SPV);
     vk::PipelineShaderStageCreateInfo fragment_stage;
     fragment_stage.stage = vk::ShaderStageFlagBits::eFragment;
     fragment_stage.module = *fragment_shader;
     fragment_stage.pName = "main";
-    stages.push_back(fragment_stage);
+    desc.stages.push_back(fragment_stage);
 
     vk::VertexInputAttributeDescription position_attr;
     position_attr.location = 0;
@@ -159,7 +159,7 @@ vk::raii::Pipeline &VulkanRenderer::create_graphics_pipeline(AssetApi &assets) {
     texture_attr.binding = 0;
     texture_attr.format = vk::Format::eR32Uint;
     texture_attr.offset = 8 * sizeof(float);
-    std::array<vk::VertexInputAttributeDescription, 4> attrs = {
+    desc.attributes = {
         position_attr,
         normal_attr,
         texcoord_attr,
@@ -169,70 +169,14 @@ vk::raii::Pipeline &VulkanRenderer::create_graphics_pipeline(AssetApi &assets) {
     vertex_binding.binding = 0;
     vertex_binding.stride = 8 * sizeof(float) + sizeof(uint32_t);
     vertex_binding.inputRate = vk::VertexInputRate::eVertex;
-    vk::PipelineVertexInputStateCreateInfo vertex_input;
-    vertex_input.setVertexAttributeDescriptions(attrs);
-    vertex_input.setVertexBindingDescriptions(vertex_binding);
-
-    vk::PipelineInputAssemblyStateCreateInfo input_assembly;
-    input_assembly.topology = vk::PrimitiveTopology::eTriangleList;
-
-    int w = m_swapchain.width(), h = m_swapchain.height();
-    vk::Viewport viewport;
-    viewport.x = 0;
-    viewport.y = 0;
-    viewport.width = w;
-    viewport.height = h;
-    viewport.minDepth = 0;
-    viewport.maxDepth = 1;
-    vk::Rect2D scissor = {{0, 0}, {w, h}};
-    vk::PipelineViewportStateCreateInfo viewport_state;
-    viewport_state.setViewports(viewport);
-    viewport_state.setScissors(scissor);
-
-    vk::PipelineRasterizationStateCreateInfo raster_state;
-    raster_state.polygonMode = vk::PolygonMode::eFill;
-    raster_state.cullMode = vk::CullModeFlagBits::eBack;
-    raster_state.frontFace = vk::FrontFace::eCounterClockwise;
-    raster_state.lineWidth = 1.0;
-
-    vk::PipelineMultisampleStateCreateInfo multisample_state;
-    multisample_state.rasterizationSamples = vk::SampleCountFlagBits::e1;
-
-    vk::PipelineDepthStencilStateCreateInfo depth_state;
-    depth_state.depthTestEnable = 1;
-    depth_state.depthWriteEnable = 1;
-    depth_state.depthCompareOp = vk::CompareOp::eGreater;
-
-    vk::PipelineColorBlendAttachmentState attachment;
-    attachment.colorWriteMask =
-        vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
-        vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
-    vk::PipelineColorBlendStateCreateInfo color_blend;
-    color_blend.setAttachments(attachment);
-
-    vk::PipelineRenderingCreateInfo rendering_info;
-    vk::Format color_format = m_swapchain.image_format();
-    rendering_info.setColorAttachmentFormats(color_format);
-    rendering_info.depthAttachmentFormat = vk::Format::eD32Sfloat;
-
-    const vk::PipelineLayout &layout = *create_pipeline_layout();
-
-    vk::GraphicsPipelineCreateInfo info;
-    info.pNext = &rendering_info;
-    info.setStages(stages);
-    info.pVertexInputState = &vertex_input;
-    info.pInputAssemblyState = &input_assembly;
-    info.pViewportState = &viewport_state;
-    info.pRasterizationState = &raster_state;
-    info.pMultisampleState = &multisample_state;
-    info.pDepthStencilState = &depth_state;
-    info.pColorBlendState = &color_blend;
-    info.layout = layout;
-
-    auto pipeline = m_device->createGraphicsPipeline(nullptr, info, nullptr);
-    m_device.set_name(*pipeline, "Renderer.m_graphics_pipelines[0]");
-    m_graphics_pipelines.push_back(std::move(pipeline));
-    return m_graphics_pipelines[m_graphics_pipelines.size() - 1];
+    desc.bindings = {vertex_binding};
+
+    desc.color_format = m_swapchain.image_format();
+    desc.layout = *create_pipeline_layout();
+
+    auto pipeline = m_pipeline_compiler.submit(std::move(desc));
+    m_graphics_pipelines.push_back(pipeline);
+    return pipeline;
 }
 
 std::shared_ptr<VulkanAllocator> create_allocator(VulkanDevice &device) {
@@ -255,14 +199,21 @@ std::shared_ptr<VulkanAllocator> create_allocator(VulkanDevice &device) {
 }
 
 VulkanRenderer::VulkanRenderer(AssetApi &assets, VulkanDevice device,
-                               VulkanSwapchain swapchain)
+                               VulkanSwapchain swapchain,
+                               std::string pipeline_cache_path,
+                               uint32_t frames_in_flight)
     : m_assets{assets}, m_device{std::move(device)},
+      m_pipeline_cache{PipelineCache::create(m_device,
+                                             std::move(pipeline_cache_path))},
       m_swapchain{std::move(swapchain)},
       m_allocator{create_allocator(m_device)},
       m_staging{StagingBuffer::create(m_allocator, 0x200'0000)},
+      m_meshes{m_allocator}, m_defragmenter{m_allocator, m_meshes},
       m_texture_map{m_assets, m_allocator, m_staging},
-      m_present_semaphore(m_device.create_semaphore()) {
-    for (int i = 0; i < 2; i++) {
+      m_drawable_extent(m_swapchain.width(), m_swapchain.height()),
+      m_pipeline_compiler{m_device, m_pipeline_cache} {
+    assert(frames_in_flight >= 1 && frames_in_flight <= MAX_FRAMES_IN_FLIGHT);
+    for (uint32_t i = 0; i < frames_in_flight; i++) {
         m_per_frame.push_back(
             PerFrame::create(i, m_device, m_swapchain, m_allocator));
     }
@@ -270,7 +221,27 @@ VulkanRenderer::VulkanRenderer(AssetApi &assets, VulkanDevice device,
 
 Mesh VulkanRenderer::create_mesh(std::span<const char> vertex_data,
                                  std::span<const uint32_t> index_data) {
-    return Mesh{m_allocator, m_staging, vertex_data, index_data};
+    return m_meshes.create(m_staging, vertex_data, index_data);
+}
+
+void VulkanRenderer::destroy_mesh(Mesh mesh) {
+    // The frame currently being recorded, or the next one if we're
+    // between frames, may still reference the mesh
+    m_meshes.destroy(mesh, m_frame + 1);
+}
+
+uint64_t VulkanRenderer::completed_frame() const {
+    // Frame n is rendered with m_per_frame[n % size], whose timeline
+    // semaphore is signaled with n
+    const uint64_t count = m_per_frame.size();
+    uint64_t completed = m_frame;
+    for (uint64_t i = 0; i < count; i++) {
+        const auto value =
+            m_per_frame[i].end_of_frame_semaphore.getCounterValue();
+        const auto next = value ? value + count : (i ? i : count);
+        completed = std::min(completed, next - 1);
+    }
+    return completed;
 }
 
 void VulkanRenderer::flush_frame() {
@@ -280,14 +251,48 @@ void VulkanRenderer::flush_frame() {
         vk::SemaphoreWaitInfo info;
         info.setSemaphores(*frame.end_of_frame_semaphore);
         info.setValues(frame.frame_in_flight);
-        auto result = m_device->waitSemaphores(info, 16'000'000);
-        if (result == vk::Result::eTimeout) {
-            // Roll back frame bump so frame can be retried
-            m_frame--;
-            throw TimeoutException("Timed out waiting for frame to finish");
+        // Blocks for as long as the device is more than
+        // m_per_frame.size() frames behind, which is what paces the CPU
+        if (m_device->waitSemaphores(info, UINT64_MAX) !=
+            vk::Result::eSuccess) {
+            throw TimeoutException("Timed out waiting for frame in flight");
         }
     }
     frame.frame_in_flight = m_frame;
+    frame.allocator.reset();
+    const auto completed = completed_frame();
+    m_meshes.collect_garbage(completed);
+    std::erase_if(m_retired_swapchains, [completed](const auto &retired) {
+        return retired.frame <= completed;
+    });
+}
+
+void VulkanRenderer::resize(vk::Extent2D extent) {
+    m_drawable_extent = extent;
+    m_swapchain.invalidate();
+}
+
+bool VulkanRenderer::recreate_swapchain() {
+    if (!m_drawable_extent.width || !m_drawable_extent.height) {
+        return false;
+    }
+    auto retired = m_swapchain.recreate(m_drawable_extent);
+    // Frames before this one may still be presenting from the old
+    // swapchain. Holding on until this frame finishes gives the
+    // presentation engine a frame of slack, since presents aren't
+    // fenced.
+    retired.frame = m_frame;
+    m_retired_swapchains.push_back(std::move(retired));
+    return true;
+}
+
+void VulkanRenderer::skip_frame() {
+    // Nothing will be submitted for this frame, so signal its semaphore
+    // from the host to keep the timeline moving
+    vk::SemaphoreSignalInfo info;
+    info.semaphore = *per_frame().end_of_frame_semaphore;
+    info.value = m_frame;
+    m_device->signalSemaphore(info);
 }
 
 void VulkanRenderer::begin_rendering() {
@@ -295,12 +300,23 @@ void VulkanRenderer::begin_rendering() {
     frame.command_pool.reset();
     auto &cmds = frame.command_buffer;
 
+    // The swapchain was resized since this frame slot was last used.
+    // Its previous frame has finished, so the old buffer is unused.
+    const vk::Extent3D extent(m_swapchain.width(), m_swapchain.height(), 1);
+    if (frame.depth_buffer.extent() != extent) {
+        frame.depth_buffer = create_depth_buffer(m_swapchain, m_allocator);
+    }
+
     vk::CommandBufferBeginInfo begin_info;
     begin_info.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
     cmds.begin(begin_info);
 
     vk::ImageMemoryBarrier2 barrier;
-    barrier.srcStageMask = vk::PipelineStageFlagBits2::eBottomOfPipe;
+    // Chains with the wait on the acquire semaphore. Offscreen images
+    // have no semaphore, so this also orders the frame after the last
+    // one to write or read back the same image.
+    barrier.srcStageMask = vk::PipelineStageFlagBits2::eColorAttachmentOutput |
+                           vk::PipelineStageFlagBits2::eCopy;
     barrier.srcAccessMask = vk::AccessFlagBits2::eNone;
     barrier.dstStageMask = vk::PipelineStageFlagBits2::eColorAttachmentOutput;
     barrier.dstAccessMask = vk::AccessFlagBits2::eColorAttachmentWrite;
@@ -362,55 +378,80 @@ void VulkanRenderer::bind_textures() {
 
 void VulkanRenderer::update_uniforms(const ViewUniforms &view) {
     auto &frame = per_frame();
-    memcpy(frame.uniforms.data(), &view, sizeof(ViewUniforms));
+    *frame.allocator.allocate<ViewUniforms>(m_view_uniforms) = view;
 }
 
 void VulkanRenderer::bind_uniforms() {
     auto &frame = per_frame();
     auto &cmds = frame.command_buffer;
-    vk::DescriptorBufferInfo buf_info;
-    buf_info.buffer = *frame.uniforms;
-    buf_info.offset = 0;
-    buf_info.range = VK_WHOLE_SIZE;
-    vk::WriteDescriptorSet write;
-    write.dstBinding = 0;
-    write.descriptorCount = 1;
-    write.descriptorType = vk::DescriptorType::eUniformBuffer;
-    write.setBufferInfo(buf_info);
+    // Push descriptors can't be dynamic, so the frame allocator's
+    // offsets go straight into the pushed descriptors instead.
+    const auto view_info = m_view_uniforms.descriptor();
+    const auto instance_info = m_instance_uniforms.descriptor();
+    std::array<vk::WriteDescriptorSet, 2> writes;
+    writes[0].dstBinding = 0;
+    writes[0].descriptorCount = 1;
+    writes[0].descriptorType = vk::DescriptorType::eUniformBuffer;
+    writes[0].setBufferInfo(view_info);
+    writes[1].dstBinding = 1;
+    writes[1].descriptorCount = 1;
+    writes[1].descriptorType = vk::DescriptorType::eUniformBuffer;
+    writes[1].setBufferInfo(instance_info);
     cmds.pushDescriptorSetKHR(vk::PipelineBindPoint::eGraphics,
-                              *m_pipeline_layouts[0], 1, write);
+                              *m_pipeline_layouts[0], 1, writes);
 }
 
 void VulkanRenderer::begin_rendering_meshes() {
     auto &frame = per_frame();
     auto &cmds = frame.command_buffer;
     m_instance = 0;
+    frame.allocator.allocate<Matrix4>(m_instance_uniforms, MAX_INSTANCES);
     bind_textures();
     bind_uniforms();
     assert(m_graphics_pipelines.size() > 0);
-    cmds.bindPipeline(vk::PipelineBindPoint::eGraphics,
-                      *m_graphics_pipelines[0]);
+    // Meshes are skipped until the pipeline has finished compiling
+    const auto pipeline = m_graphics_pipelines[0].get();
+    m_pipeline_bound = !!pipeline;
+    if (m_pipeline_bound) {
+        cmds.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+        vk::Viewport viewport;
+        viewport.x = 0;
+        viewport.y = 0;
+        viewport.width = m_swapchain.width();
+        viewport.height = m_swapchain.height();
+        viewport.minDepth = 0;
+        viewport.maxDepth = 1;
+        cmds.setViewport(0, viewport);
+        vk::Rect2D scissor = {
+            {0, 0}, vk::Extent2D(m_swapchain.width(), m_swapchain.height())};
+        cmds.setScissor(0, scissor);
+    }
 }
 
-void VulkanRenderer::render_mesh(const Mesh &mesh, Matrix4 instance) {
+void VulkanRenderer::render_mesh(Mesh handle, Matrix4 instance) {
+    const auto *mesh = m_meshes.get(handle);
+    if (!mesh || !m_pipeline_bound) {
+        return;
+    }
     auto &frame = per_frame();
     auto &cmds = frame.command_buffer;
-    Uniforms *uniforms = (Uniforms *)frame.uniforms.data();
-    uniforms->instance[m_instance] = instance;
-    mesh.bind(cmds);
-    cmds.drawIndexed(mesh.size(), 1, 0, 0, m_instance);
+    assert(m_instance < MAX_INSTANCES);
+    auto *instances = static_cast<Matrix4 *>(m_instance_uniforms.data);
+    instances[m_instance] = instance;
+    mesh->bind(cmds);
+    cmds.drawIndexed(mesh->size, 1, 0, 0, m_instance);
     m_instance++;
 }
 
 void VulkanRenderer::render_chunk(const Chunk &chunk) {
-    const auto &mesh = chunk.mesh();
+    const auto mesh = chunk.mesh();
     if (!mesh) {
         return;
     }
 
     auto instance = Matrix4::identity();
     instance[3] = chunk.pos().offset();
-    render_mesh(*mesh, instance);
+    render_mesh(mesh, instance);
 }
 
 void VulkanRenderer::end_rendering() {
@@ -421,10 +462,15 @@ void VulkanRenderer::end_rendering() {
     vk::ImageMemoryBarrier2 barrier;
     barrier.srcStageMask = vk::PipelineStageFlagBits2::eColorAttachmentOutput;
     barrier.srcAccessMask = vk::AccessFlagBits2::eColorAttachmentWrite;
-    barrier.dstStageMask = vk::PipelineStageFlagBits2::eTopOfPipe;
-    barrier.dstAccessMask = vk::AccessFlagBits2::eNone;
+    if (m_swapchain.offscreen()) {
+        barrier.dstStageMask = vk::PipelineStageFlagBits2::eCopy;
+        barrier.dstAccessMask = vk::AccessFlagBits2::eTransferRead;
+    } else {
+        barrier.dstStageMask = vk::PipelineStageFlagBits2::eTopOfPipe;
+        barrier.dstAccessMask = vk::AccessFlagBits2::eNone;
+    }
     barrier.oldLayout = vk::ImageLayout::eColorAttachmentOptimal;
-    barrier.newLayout = vk::ImageLayout::ePresentSrcKHR;
+    barrier.newLayout = m_swapchain.present_layout();
     barrier.image = m_swapchain.current_image();
     barrier.subresourceRange = vk::ImageSubresourceRange{
         vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1,
@@ -433,37 +479,146 @@ void VulkanRenderer::end_rendering() {
     dep.setImageMemoryBarriers(barrier);
     cmds.pipelineBarrier2(dep);
 
+    if (m_readback_requested) {
+        record_readback();
+    }
+
     cmds.end();
+}
+
+void VulkanRenderer::record_readback() {
+    auto &cmds = per_frame().command_buffer;
+    const vk::DeviceSize size = image_size(
+        PixelFormat::Rgba8, m_swapchain.width(), m_swapchain.height());
+    if (!m_readback || m_readback->size() < size) {
+        vk::BufferCreateInfo info;
+        info.size = size;
+        info.usage = vk::BufferUsageFlagBits::eTransferDst;
+        info.sharingMode = vk::SharingMode::eExclusive;
+        VmaAllocationCreateInfo alloc_info = {};
+        alloc_info.usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST;
+        alloc_info.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT |
+                           VMA_ALLOCATION_CREATE_MAPPED_BIT;
+        // The previous frame's readback may still be copying into the
+        // old buffer
+        wait_idle();
+        m_readback = VulkanAllocator::create_buffer(m_allocator, info,
+                                                    alloc_info);
+    }
+
+    vk::BufferImageCopy2 region;
+    region.bufferOffset = 0;
+    region.imageSubresource =
+        vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, 0, 0, 1};
+    region.imageExtent =
+        vk::Extent3D(m_swapchain.width(), m_swapchain.height(), 1);
+    vk::CopyImageToBufferInfo2 info;
+    info.srcImage = m_swapchain.current_image();
+    info.srcImageLayout = vk::ImageLayout::eTransferSrcOptimal;
+    info.dstBuffer = **m_readback;
+    info.setRegions(region);
+    cmds.copyImageToBuffer2(info);
+
+    // Waiting on the frame's semaphore only orders device work; the
+    // copy's writes must also be made available to the host
+    vk::MemoryBarrier2 barrier;
+    barrier.srcStageMask = vk::PipelineStageFlagBits2::eCopy;
+    barrier.srcAccessMask = vk::AccessFlagBits2::eTransferWrite;
+    barrier.dstStageMask = vk::PipelineStageFlagBits2::eHost;
+    barrier.dstAccessMask = vk::AccessFlagBits2::eHostRead;
+    vk::DependencyInfo dependency;
+    dependency.setMemoryBarriers(barrier);
+    cmds.pipelineBarrier2(dependency);
+
+    m_readback_requested = false;
+    m_readback_frame = m_frame;
+}
+
+void VulkanRenderer::latch_view(const Matrix4 &view) {
+    assert(m_view_uniforms.data);
+    static_cast<ViewUniforms *>(m_view_uniforms.data)->view = view;
+}
+
+void VulkanRenderer::submit() {
+    auto &frame = per_frame();
+    auto &cmds = frame.command_buffer;
+    frame.allocator.flush();
 
-    vk::SemaphoreSubmitInfo wait_acquire;
-    wait_acquire.semaphore = *m_swapchain.image_acquire_semaphore();
-    wait_acquire.stageMask = vk::PipelineStageFlagBits2::eColorAttachmentOutput;
+    std::vector<vk::SemaphoreSubmitInfo> wait_infos;
     std::vector<vk::SemaphoreSubmitInfo> signal_infos;
     vk::SemaphoreSubmitInfo signal_end_of_frame;
     signal_end_of_frame.semaphore = *frame.end_of_frame_semaphore;
     signal_end_of_frame.stageMask = vk::PipelineStageFlagBits2::eBottomOfPipe;
     signal_end_of_frame.value = m_frame;
     signal_infos.push_back(signal_end_of_frame);
-    vk::SemaphoreSubmitInfo signal_present;
-    signal_present.semaphore = *m_present_semaphore;
-    signal_present.stageMask =
-        vk::PipelineStageFlagBits2::eColorAttachmentOutput;
-    signal_infos.push_back(signal_present);
+    // Offscreen images are neither acquired nor presented
+    if (!m_swapchain.offscreen()) {
+        vk::SemaphoreSubmitInfo wait_acquire;
+        wait_acquire.semaphore = *frame.image_acquire_semaphore;
+        wait_acquire.stageMask =
+            vk::PipelineStageFlagBits2::eColorAttachmentOutput;
+        wait_infos.push_back(wait_acquire);
+        vk::SemaphoreSubmitInfo signal_present;
+        signal_present.semaphore = *m_swapchain.current_present_semaphore();
+        signal_present.stageMask =
+            vk::PipelineStageFlagBits2::eColorAttachmentOutput;
+        signal_infos.push_back(signal_present);
+    }
     vk::CommandBufferSubmitInfo submit_cmds;
     submit_cmds.commandBuffer = *cmds;
     vk::SubmitInfo2 info;
-    info.setWaitSemaphoreInfos(wait_acquire);
+    info.setWaitSemaphoreInfos(wait_infos);
     info.setSignalSemaphoreInfos(signal_infos);
     info.setCommandBufferInfos(submit_cmds);
     m_device.graphics_queue().submit2(info, nullptr);
 }
 
-void VulkanRenderer::acquire_image() {
-    m_swapchain.acquire_next_image(16'000'000);
+void VulkanRenderer::request_readback() {
+    assert(m_swapchain.offscreen());
+    m_readback_requested = true;
+}
+
+Image VulkanRenderer::read_back() {
+    assert(m_readback);
+    const auto &frame = m_per_frame[m_readback_frame % m_per_frame.size()];
+    vk::SemaphoreWaitInfo info;
+    info.setSemaphores(*frame.end_of_frame_semaphore);
+    info.setValues(m_readback_frame);
+    if (m_device->waitSemaphores(info, UINT64_MAX) != vk::Result::eSuccess) {
+        throw TimeoutException("Timed out waiting for frame to read back");
+    }
+
+    const auto width = m_swapchain.width(), height = m_swapchain.height();
+    const auto size = image_size(PixelFormat::Rgba8, width, height);
+    m_readback->invalidate(0, size);
+    const auto *data = static_cast<const char *>(m_readback->data());
+    return Image::create(PixelFormat::Rgba8, width, height, 1,
+                         std::vector<char>(data, data + size));
+}
+
+bool VulkanRenderer::acquire_image() {
+    // An out of date swapchain gets one recreation attempt per frame
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (m_swapchain.out_of_date() && !recreate_swapchain()) {
+            break;
+        }
+        // flush_frame() waited for this frame slot's last submit, so its
+        // acquire semaphore is no longer pending
+        if (m_swapchain.acquire_next_image(
+                UINT64_MAX, *per_frame().image_acquire_semaphore)) {
+            return true;
+        }
+    }
+    skip_frame();
+    return false;
 }
 
 void VulkanRenderer::present() {
-    m_swapchain.present(m_device.graphics_queue(), {&*m_present_semaphore, 1});
+    m_swapchain.present(m_device.graphics_queue());
+}
+
+void VulkanRenderer::defragment_meshes() {
+    m_defragmenter.step(m_device.graphics_queue(), m_frame, completed_frame());
 }
 
 void VulkanRenderer::wait_idle() {
@@ -4,10 +4,14 @@
 #include <vk_mem_alloc.h>
 
 #include "asset.h"
+#include "image.h"
 #include "math/matrix.h"
+#include "vulkan/defragment.h"
 #include "vulkan/device.h"
+#include "vulkan/frame_allocator.h"
 #include "vulkan/memory.h"
 #include "vulkan/mesh.h"
+#include "vulkan/pipeline.h"
 #include "vulkan/staging.h"
 #include "vulkan/texture_map.h"
 
@@ -18,18 +22,23 @@ struct ViewUniforms {
     Matrix4 view;
 };
 
-struct Uniforms {
-    ViewUniforms view_uniforms;
-    Matrix4 instance[512];
-};
+// Must match the size of u_instance in the shaders
+const uint32_t MAX_INSTANCES = 512;
+
+/// More frames in flight keep the GPU busier at the cost of latency.
+const uint32_t DEFAULT_FRAMES_IN_FLIGHT = 2;
+const uint32_t MAX_FRAMES_IN_FLIGHT = 4;
 
 struct PerFrame {
     vk::raii::Semaphore end_of_frame_semaphore;
+    // Binary, so it can't be shared between frames: the next acquire
+    // could signal it before this frame's submit has waited on it
+    vk::raii::Semaphore image_acquire_semaphore;
     vk::raii::CommandPool command_pool;
     vk::raii::CommandBuffer command_buffer;
 
     VulkanImage depth_buffer;
-    VulkanBuffer uniforms;
+    FrameAllocator allocator;
 
     uint64_t frame_in_flight = 0;
 
@@ -41,63 +50,135 @@ struct PerFrame {
 class VulkanRenderer {
     AssetApi &m_assets;
     VulkanDevice m_device;
+    PipelineCache m_pipeline_cache;
     VulkanSwapchain m_swapchain;
     std::shared_ptr<VulkanAllocator> m_allocator;
     StagingBuffer m_staging;
+    MeshRegistry m_meshes;
+    MeshDefragmenter m_defragmenter;
     TextureMap m_texture_map;
 
     std::vector<PerFrame> m_per_frame;
-    vk::raii::Semaphore m_present_semaphore;
+    std::vector<RetiredSwapchain> m_retired_swapchains;
+    // Size the swapchain is recreated with, as last reported by resize()
+    vk::Extent2D m_drawable_extent;
 
     std::vector<vk::raii::ShaderModule> m_shaders;
     std::vector<vk::raii::DescriptorSetLayout> m_set_layouts;
     std::vector<vk::raii::PipelineLayout> m_pipeline_layouts;
-    std::vector<vk::raii::Pipeline> m_graphics_pipelines;
+    std::vector<PipelineHandle> m_graphics_pipelines;
+    // Declared after the shaders and layouts so its threads are joined
+    // before anything they might be compiling with is destroyed
+    PipelineCompiler m_pipeline_compiler;
 
     uint64_t m_frame = 0;
     uint32_t m_instance = 0;
+    bool m_pipeline_bound = false;
+    FrameAllocation m_view_uniforms;
+    FrameAllocation m_instance_uniforms;
+
+    std::optional<VulkanBuffer> m_readback;
+    bool m_readback_requested = false;
+    uint64_t m_readback_frame = 0;
 
     PerFrame &per_frame() { return m_per_frame[m_frame % m_per_frame.size()]; }
 
     vk::raii::DescriptorSetLayout &create_set_layout();
-    vk::raii::ShaderModule &create_shader_module(std::span<const char> bytes);
+    vk::raii::ShaderModule &
+    create_shader_module(std::span<const uint32_t> code);
     vk::raii::PipelineLayout &create_pipeline_layout();
     void bind_textures();
     void bind_uniforms();
+    void record_readback();
+    /// Returns false if the window has no area to present to.
+    bool recreate_swapchain();
+    void skip_frame();
 
     friend class StagingBuffer;
 
 public:
+    /// `pipeline_cache_path` names the file pipelines are cached in
+    /// between runs; see PipelineCache.
     VulkanRenderer(AssetApi &assets, VulkanDevice device,
-                   VulkanSwapchain swapchain);
+                   VulkanSwapchain swapchain,
+                   std::string pipeline_cache_path = {},
+                   uint32_t frames_in_flight = DEFAULT_FRAMES_IN_FLIGHT);
 
     VulkanDevice &device() { return m_device; }
     VulkanSwapchain &swapchain() { return m_swapchain; }
+    /// @brief Recreates the swapchain with size `extent` before the next
+    /// frame. Zero while the window is minimized.
+    void resize(vk::Extent2D extent);
     const std::shared_ptr<VulkanAllocator> &allocator() const {
         return m_allocator;
     }
     StagingBuffer &staging() { return m_staging; }
     TextureMap &textures() { return m_texture_map; }
+    const MeshRegistry &meshes() const { return m_meshes; }
+    /// @brief Allocator for data that only needs to live until the
+    /// current frame finishes rendering.
+    FrameAllocator &frame_allocator() { return per_frame().allocator; }
 
     Mesh create_mesh(std::span<const char> vertex_data,
                      std::span<const uint32_t> index_data);
+    /// @brief Destroys the mesh once no frame in flight can be drawing
+    /// it anymore.
+    void destroy_mesh(Mesh mesh);
     uint32_t load_texture(const std::string &path) {
         return m_texture_map.get(path);
     }
 
+    /// @brief Returns the newest frame such that it and all frames
+    /// before it have finished executing on the device.
+    uint64_t completed_frame() const;
+    /// @brief False if the last frame skipped its meshes because the
+    /// pipeline wasn't ready yet.
+    bool drew_meshes() const { return m_pipeline_bound; }
+
+    uint32_t frames_in_flight() const { return m_per_frame.size(); }
+
     // XXX: Move these methods to PerFrame class
+    /// @brief Starts a new frame, first blocking until the frame that
+    /// last used its resources has finished on the device.
     void flush_frame();
     void begin_rendering();
     void update_uniforms(const ViewUniforms &view);
     void begin_rendering_meshes();
-    void render_mesh(const Mesh &mesh, Matrix4 instance);
+    void render_mesh(Mesh mesh, Matrix4 instance);
     void render_chunk(const Chunk &chunk);
+    /// @brief Finishes recording the frame without submitting it.
     void end_rendering();
-    void acquire_image();
+    /// @brief Overwrites the view matrix given to update_uniforms() for
+    /// the recorded frame. Call between end_rendering() and submit() to
+    /// render with the freshest camera. Anything culled on the CPU was
+    /// culled with the old matrix.
+    void latch_view(const Matrix4 &view);
+    void submit();
+    /// @brief Has the current frame copy its color target to the host
+    /// once it's rendered. Call before end_rendering(). Only offscreen
+    /// targets can be read back.
+    void request_readback();
+    /// @brief Waits for the last frame a readback was requested for and
+    /// returns its pixels as RGBA8. The next readback overwrites them,
+    /// so call this before the next frame's end_rendering().
+    Image read_back();
+    /// @brief Acquires the next swapchain image, recreating the
+    /// swapchain first if it's out of date. If no image can be acquired,
+    /// e.g. while the window is minimized, the frame is skipped and this
+    /// returns false; render nothing until the next flush_frame().
+    bool acquire_image();
     void present();
+    /// @brief Runs one incremental step of mesh memory compaction.
+    /// Call once per frame after presenting.
+    void defragment_meshes();
     void wait_idle();
 
-    vk::raii::Pipeline &create_graphics_pipeline(AssetApi &assets);
+    /// @brief Starts compiling the chunk pipeline in the background.
+    /// Meshes aren't drawn until it's ready.
+    PipelineHandle create_graphics_pipeline();
+    /// @brief Persists compiled pipelines so later runs can skip
+    /// compiling them. Call on shutdown.
+    void save_pipeline_cache() { m_pipeline_cache.save(); }
 };
 
 #endif
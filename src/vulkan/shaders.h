@@ -0,0 +1,17 @@
+#ifndef VULKAN_SHADERS_H_INCLUDED
+#define VULKAN_SHADERS_H_INCLUDED
+
+#include <cstdint>
+
+// SPIR-V compiled from src/shaders at build time. The included files are
+// generated by glslc -mfmt=num; see meson.build.
+
+inline constexpr uint32_t CHUNK_VERTEX_SPV[] = {
+#include "chunk.vertex.spv.inc"
+};
+
+inline constexpr uint32_t CHUNK_FRAGMENT_SPV[] = {
+#include "chunk.fragment.spv.inc"
+};
+
+#endif
@@ -1,7 +1,10 @@
 #include "vulkan/staging.h"
 
+#include <algorithm>
 #include <cstring>
+#include <numeric>
 #include <tuple>
+#include <vector>
 
 #include "exceptions.h"
 #include "image.h"
@@ -51,8 +54,7 @@ void StagingBuffer::begin_staging() {
 }
 
 uint64_t StagingBuffer::stage_buffer(std::span<const char> data,
-                                     VulkanBuffer &dest,
-                                     vk::DeviceSize offset) {
+                                     vk::Buffer dest, vk::DeviceSize offset) {
     assert(m_staging);
     if (m_offset + data.size() > m_size) {
         throw OutOfMemoryException("Staging buffer out of memory");
@@ -67,75 +69,102 @@ uint64_t StagingBuffer::stage_buffer(std::span<const char> data,
     copy.srcOffset = m_offset;
     copy.dstOffset = offset;
     copy.size = data.size();
-    vk::CopyBufferInfo2 info;
-    info.srcBuffer = *m_buffer;
-    info.dstBuffer = *dest;
-    info.setRegions(copy);
-    m_command_buffer.copyBuffer2(info);
+    m_buffer_copies.push_back({dest, copy});
 
     m_offset += data.size();
     return m_pending_batch + 1;
 }
 
 uint64_t StagingBuffer::stage_image(const Image &src, VulkanImage &dest,
-                                    bool generate_mipmaps) {
-    assert(m_staging);
+                                    uint32_t layer, bool generate_mipmaps) {
     const auto data = src.data();
-    assert(dest.width() == src.width() && dest.height() == src.height() &&
+    const auto staged =
+        reserve_image(src.desc(), dest, layer, generate_mipmaps);
+    std::memcpy(staged.data.data(), data.data(), data.size());
+    return staged.batch;
+}
+
+StagedImage StagingBuffer::reserve_image(const ImageDesc &src,
+                                         VulkanImage &dest, uint32_t layer,
+                                         bool generate_mipmaps) {
+    assert(m_staging);
+    const auto size = src.size();
+    assert(dest.width() == src.width && dest.height() == src.height &&
            dest.depth() == 1);
-    assert(src.format() == vk_to_format(dest.format()));
-    assert(dest.array_layers() == 1);
-    if (m_offset + data.size() > m_size) {
+    assert(src.format == vk_to_format(dest.format()));
+    assert(layer < dest.array_layers());
+    assert(src.mip_levels <= dest.mip_levels());
+    assert(!generate_mipmaps || src.mip_levels == 1);
+
+    // Step 1: Reserve space in the staging buffer. Copies must start on
+    // a whole texel block.
+    const vk::DeviceSize alignment =
+        std::lcm<vk::DeviceSize>(format_block_size(src.format), 4);
+    const auto offset = (m_offset + alignment - 1) / alignment * alignment;
+    if (offset + size > m_size) {
         throw OutOfMemoryException("Staging buffer out of memory");
     }
+    m_offset = offset;
+    const std::span<char> data{(char *)m_buffer.data() + m_offset, size};
 
-    // Step 1: Write to staging buffer
-    std::memcpy((void *)((const char *)m_buffer.data() + m_offset), data.data(),
-                data.size());
-
+    const uint32_t mip_levels =
+        generate_mipmaps ? dest.mip_levels() : src.mip_levels;
     vk::ImageSubresourceRange range;
     range.aspectMask = vk::ImageAspectFlagBits::eColor;
     range.baseMipLevel = 0;
-    range.levelCount = 1;
-    range.baseArrayLayer = 0;
+    range.levelCount = mip_levels;
+    range.baseArrayLayer = layer;
     range.layerCount = 1;
 
-    // Step 2: Transition to TransferDstOptimal
+    // Step 2: Transition to TransferDstOptimal, after the image has been
+    // initialized if it's new
     {
         vk::ImageMemoryBarrier2 img_barrier;
+        img_barrier.srcStageMask = vk::PipelineStageFlagBits2::eAllTransfer;
         img_barrier.dstStageMask = vk::PipelineStageFlagBits2::eAllTransfer;
         img_barrier.dstAccessMask = vk::AccessFlagBits2::eTransferWrite;
         img_barrier.oldLayout = vk::ImageLayout::eUndefined;
         img_barrier.newLayout = vk::ImageLayout::eTransferDstOptimal;
         img_barrier.image = *dest;
         img_barrier.subresourceRange = range;
-        vk::DependencyInfo dep;
-        dep.setImageMemoryBarriers(img_barrier);
-        m_command_buffer.pipelineBarrier2(dep);
+        m_pre_barriers.push_back(img_barrier);
     }
 
-    // Step 3: Copy from staging to image
-    vk::BufferImageCopy2 copy;
-    copy.bufferOffset = m_offset;
-    copy.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
-    copy.imageSubresource.mipLevel = 0;
-    copy.imageSubresource.baseArrayLayer = 0;
-    copy.imageSubresource.layerCount = 1;
-    copy.imageExtent = dest.extent();
-    vk::CopyBufferToImageInfo2 info;
-    info.srcBuffer = *m_buffer;
-    info.dstImage = *dest;
-    info.dstImageLayout = vk::ImageLayout::eTransferDstOptimal;
-    info.setRegions(copy);
-    m_command_buffer.copyBufferToImage2(info);
-
-    // Step 4: Create mipmaps
-    // Step 4.1: Transition to TransferSrcOptimal
-    // Step 4.2: Copy to mip levels
-    assert(!generate_mipmaps);
-
-    // Step 6: Transition to ShaderReadOnlyOptimal
-    {
+    // Step 3: Copy from staging to image, including any mip levels that
+    // came with the source
+    for (uint32_t level = 0; level < src.mip_levels; level++) {
+        vk::BufferImageCopy2 copy;
+        copy.bufferOffset = m_offset + src.level_offset(level);
+        copy.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+        copy.imageSubresource.mipLevel = level;
+        copy.imageSubresource.baseArrayLayer = layer;
+        copy.imageSubresource.layerCount = 1;
+        copy.imageExtent = vk::Extent3D(src.level_width(level),
+                                        src.level_height(level), 1);
+        m_image_copies.push_back({*dest, copy});
+    }
+
+    // Step 4: Create mipmaps. The blits are recorded at end_staging so
+    // that each level is generated for every image at once.
+    const bool blit_mipmaps = generate_mipmaps && mip_levels > 1;
+    if (blit_mipmaps) {
+        m_mipmap_jobs.push_back({*dest, dest.extent(), mip_levels, layer});
+    }
+
+    // Step 5: Transition to ShaderReadOnlyOptimal. Mip generation
+    // leaves every level but the last in TransferSrcOptimal.
+    if (!blit_mipmaps) {
+        vk::ImageMemoryBarrier2 img_barrier;
+        img_barrier.srcStageMask = vk::PipelineStageFlagBits2::eAllTransfer;
+        img_barrier.srcAccessMask = vk::AccessFlagBits2::eTransferWrite;
+        img_barrier.dstStageMask = vk::PipelineStageFlagBits2::eFragmentShader;
+        img_barrier.dstAccessMask = vk::AccessFlagBits2::eShaderSampledRead;
+        img_barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+        img_barrier.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+        img_barrier.image = *dest;
+        img_barrier.subresourceRange = range;
+        m_post_barriers.push_back(img_barrier);
+    } else {
         vk::ImageMemoryBarrier2 img_barrier;
         img_barrier.srcStageMask = vk::PipelineStageFlagBits2::eAllTransfer;
         img_barrier.srcAccessMask = vk::AccessFlagBits2::eTransferWrite;
@@ -145,18 +174,173 @@ uint64_t StagingBuffer::stage_image(const Image &src, VulkanImage &dest,
         img_barrier.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
         img_barrier.image = *dest;
         img_barrier.subresourceRange = range;
+        img_barrier.subresourceRange.baseMipLevel = mip_levels - 1;
+        img_barrier.subresourceRange.levelCount = 1;
+        m_post_barriers.push_back(img_barrier);
+        img_barrier.srcAccessMask = vk::AccessFlagBits2::eTransferRead;
+        img_barrier.oldLayout = vk::ImageLayout::eTransferSrcOptimal;
+        img_barrier.subresourceRange.baseMipLevel = 0;
+        img_barrier.subresourceRange.levelCount = mip_levels - 1;
+        m_post_barriers.push_back(img_barrier);
+    }
+
+    m_offset += size;
+    return {m_pending_batch + 1, data};
+}
+
+void StagingBuffer::initialize_image(const VulkanImage &image,
+                                     vk::ImageLayout layout) {
+    assert(m_staging);
+    vk::ImageMemoryBarrier2 img_barrier;
+    img_barrier.dstStageMask = vk::PipelineStageFlagBits2::eAllTransfer;
+    img_barrier.oldLayout = vk::ImageLayout::eUndefined;
+    img_barrier.newLayout = layout;
+    img_barrier.image = *image;
+    img_barrier.subresourceRange = vk::ImageSubresourceRange{
+        vk::ImageAspectFlagBits::eColor, 0, image.mip_levels(), 0,
+        image.array_layers()};
+    m_init_barriers.push_back(img_barrier);
+}
+
+void StagingBuffer::record_transfers() {
+    // Separate from the upload transitions, which may cover the same
+    // subresources
+    if (!m_init_barriers.empty()) {
+        vk::DependencyInfo dep;
+        dep.setImageMemoryBarriers(m_init_barriers);
+        m_command_buffer.pipelineBarrier2(dep);
+    }
+    if (!m_pre_barriers.empty()) {
         vk::DependencyInfo dep;
-        dep.setImageMemoryBarriers(img_barrier);
+        dep.setImageMemoryBarriers(m_pre_barriers);
         m_command_buffer.pipelineBarrier2(dep);
     }
 
-    m_offset += data.size();
-    return m_pending_batch + 1;
+    // Consecutive copies into the same buffer share one command
+    std::vector<vk::BufferCopy2> regions;
+    for (size_t i = 0; i < m_buffer_copies.size();) {
+        const auto dest = m_buffer_copies[i].first;
+        regions.clear();
+        for (; i < m_buffer_copies.size() && m_buffer_copies[i].first == dest;
+             i++) {
+            regions.push_back(m_buffer_copies[i].second);
+        }
+        vk::CopyBufferInfo2 info;
+        info.srcBuffer = *m_buffer;
+        info.dstBuffer = dest;
+        info.setRegions(regions);
+        m_command_buffer.copyBuffer2(info);
+    }
+
+    for (const auto &[dest, copy] : m_image_copies) {
+        vk::CopyBufferToImageInfo2 info;
+        info.srcBuffer = *m_buffer;
+        info.dstImage = dest;
+        info.dstImageLayout = vk::ImageLayout::eTransferDstOptimal;
+        info.setRegions(copy);
+        m_command_buffer.copyBufferToImage2(info);
+    }
+
+    record_mipmaps();
+
+    // Buffers only need their writes made visible; a global barrier
+    // covers all of them at once
+    vk::MemoryBarrier2 mem_barrier;
+    mem_barrier.srcStageMask = vk::PipelineStageFlagBits2::eAllTransfer;
+    mem_barrier.srcAccessMask = vk::AccessFlagBits2::eTransferWrite;
+    mem_barrier.dstStageMask =
+        vk::PipelineStageFlagBits2::eVertexAttributeInput |
+        vk::PipelineStageFlagBits2::eIndexInput;
+    mem_barrier.dstAccessMask = vk::AccessFlagBits2::eVertexAttributeRead |
+                                vk::AccessFlagBits2::eIndexRead;
+    vk::DependencyInfo dep;
+    if (!m_buffer_copies.empty()) {
+        dep.setMemoryBarriers(mem_barrier);
+    }
+    dep.setImageMemoryBarriers(m_post_barriers);
+    if (!m_buffer_copies.empty() || !m_post_barriers.empty()) {
+        m_command_buffer.pipelineBarrier2(dep);
+    }
+
+    m_init_barriers.clear();
+    m_pre_barriers.clear();
+    m_buffer_copies.clear();
+    m_image_copies.clear();
+    m_mipmap_jobs.clear();
+    m_post_barriers.clear();
+}
+
+static vk::Offset3D mip_extent(vk::Extent3D extent, uint32_t level) {
+    return vk::Offset3D(std::max(extent.width >> level, 1u),
+                        std::max(extent.height >> level, 1u),
+                        std::max(extent.depth >> level, 1u));
+}
+
+void StagingBuffer::record_mipmaps() {
+    uint32_t max_levels = 1;
+    for (const auto &job : m_mipmap_jobs) {
+        max_levels = std::max(max_levels, job.mip_levels);
+    }
+
+    // Each level is downsampled from the one before it, so every image
+    // moves through the chain in lockstep: one barrier and then one
+    // round of blits per level
+    std::vector<vk::ImageMemoryBarrier2> barriers;
+    for (uint32_t level = 1; level < max_levels; level++) {
+        barriers.clear();
+        for (const auto &job : m_mipmap_jobs) {
+            if (level >= job.mip_levels) {
+                continue;
+            }
+            vk::ImageMemoryBarrier2 barrier;
+            barrier.srcStageMask = vk::PipelineStageFlagBits2::eAllTransfer;
+            barrier.srcAccessMask = vk::AccessFlagBits2::eTransferWrite;
+            barrier.dstStageMask = vk::PipelineStageFlagBits2::eAllTransfer;
+            barrier.dstAccessMask = vk::AccessFlagBits2::eTransferRead;
+            barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+            barrier.newLayout = vk::ImageLayout::eTransferSrcOptimal;
+            barrier.image = job.image;
+            barrier.subresourceRange.aspectMask =
+                vk::ImageAspectFlagBits::eColor;
+            barrier.subresourceRange.baseMipLevel = level - 1;
+            barrier.subresourceRange.levelCount = 1;
+            barrier.subresourceRange.baseArrayLayer = job.layer;
+            barrier.subresourceRange.layerCount = 1;
+            barriers.push_back(barrier);
+        }
+        vk::DependencyInfo dep;
+        dep.setImageMemoryBarriers(barriers);
+        m_command_buffer.pipelineBarrier2(dep);
+
+        for (const auto &job : m_mipmap_jobs) {
+            if (level >= job.mip_levels) {
+                continue;
+            }
+            vk::ImageBlit2 blit;
+            blit.srcSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+            blit.srcSubresource.mipLevel = level - 1;
+            blit.srcSubresource.baseArrayLayer = job.layer;
+            blit.srcSubresource.layerCount = 1;
+            blit.srcOffsets[1] = mip_extent(job.extent, level - 1);
+            blit.dstSubresource = blit.srcSubresource;
+            blit.dstSubresource.mipLevel = level;
+            blit.dstOffsets[1] = mip_extent(job.extent, level);
+            vk::BlitImageInfo2 info;
+            info.srcImage = job.image;
+            info.srcImageLayout = vk::ImageLayout::eTransferSrcOptimal;
+            info.dstImage = job.image;
+            info.dstImageLayout = vk::ImageLayout::eTransferDstOptimal;
+            info.setRegions(blit);
+            info.filter = vk::Filter::eLinear;
+            m_command_buffer.blitImage2(info);
+        }
+    }
 }
 
 void StagingBuffer::end_staging(vk::raii::Queue &queue) {
     assert(m_staging);
     m_staging = false;
+    record_transfers();
     m_command_buffer.end();
     m_pending_batch++;
 
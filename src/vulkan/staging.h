@@ -1,12 +1,40 @@
 #ifndef VULKAN_STAGING_H_INCLUDED
 #define VULKAN_STAGING_H_INCLUDED
 
+#include <utility>
+#include <vector>
+
 #include <vk_mem_alloc.h>
 
 #include "image.h"
 #include "vulkan/device.h"
 #include "vulkan/memory.h"
 
+/// @brief An image layer whose mip chain is generated from its base
+/// level after the upload.
+struct MipmapJob {
+    vk::Image image;
+    vk::Extent3D extent;
+    uint32_t mip_levels;
+    uint32_t layer;
+};
+
+/// @brief Space reserved in the staging buffer for an image upload.
+/// `data` must be filled in before end_staging.
+struct StagedImage {
+    uint64_t batch;
+    std::span<char> data;
+};
+
+/// @brief Uploads buffer and image data through a host-visible buffer.
+///
+/// Transfers are accumulated between begin_staging and end_staging and
+/// recorded as three phases: one barrier transitioning every image to
+/// TransferDstOptimal, all the copies, and one barrier making the
+/// results visible to shaders. Mip chains are generated between the
+/// copies and the final barrier, one level at a time across all images.
+/// Images registered with initialize_image are transitioned in a barrier
+/// of their own ahead of all of these.
 class StagingBuffer {
     const VulkanDevice &m_device;
     const vk::DeviceSize m_size;
@@ -18,6 +46,16 @@ class StagingBuffer {
     uint64_t m_pending_batch = 0;
     bool m_staging = false;
 
+    std::vector<vk::ImageMemoryBarrier2> m_init_barriers;
+    std::vector<vk::ImageMemoryBarrier2> m_pre_barriers;
+    std::vector<std::pair<vk::Buffer, vk::BufferCopy2>> m_buffer_copies;
+    std::vector<std::pair<vk::Image, vk::BufferImageCopy2>> m_image_copies;
+    std::vector<MipmapJob> m_mipmap_jobs;
+    std::vector<vk::ImageMemoryBarrier2> m_post_barriers;
+
+    void record_transfers();
+    void record_mipmaps();
+
     StagingBuffer(const VulkanDevice &device, size_t size,
                   vk::raii::Semaphore semaphore, VulkanBuffer buffer,
                   vk::raii::CommandPool command_pool,
@@ -36,10 +74,19 @@ public:
     const vk::DeviceSize remaining() const { return m_size - m_offset; }
 
     void begin_staging();
-    uint64_t stage_buffer(std::span<const char> data, VulkanBuffer &dest,
+    uint64_t stage_buffer(std::span<const char> data, vk::Buffer dest,
                           vk::DeviceSize offset);
     uint64_t stage_image(const Image &src, VulkanImage &dest,
-                         bool generate_mipmaps = false);
+                         uint32_t layer = 0, bool generate_mipmaps = false);
+    /// @brief Records the upload of an image described by `desc` and
+    /// returns the staging memory to write its pixels to. Lets callers
+    /// decode straight into the staging buffer.
+    StagedImage reserve_image(const ImageDesc &desc, VulkanImage &dest,
+                              uint32_t layer = 0,
+                              bool generate_mipmaps = false);
+    /// @brief Records a transition of every subresource of a new color
+    /// image from Undefined to `layout`, ahead of any uploads to it.
+    void initialize_image(const VulkanImage &image, vk::ImageLayout layout);
     void end_staging(vk::raii::Queue &queue);
     void wait() const;
 };
@@ -1,6 +1,9 @@
 #include "vulkan/texture_map.h"
 
+#include <algorithm>
+#include <bit>
 #include <cassert>
+#include <exception>
 #include <format>
 #include <optional>
 
@@ -61,16 +64,26 @@ uint32_t ImageDescriptorHeap::add(const vk::raii::ImageView &view,
     info.sampler = *sampler;
     info.imageView = *view;
     info.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    if (m_pending.empty()) {
+        m_pending_start = index;
+    }
+    m_pending.push_back(info);
+
+    return index;
+}
+
+void ImageDescriptorHeap::flush() {
+    if (m_pending.empty()) {
+        return;
+    }
     vk::WriteDescriptorSet write;
     write.dstSet = *m_set;
     write.dstBinding = 0;
-    write.dstArrayElement = index;
+    write.dstArrayElement = m_pending_start;
     write.descriptorType = vk::DescriptorType::eCombinedImageSampler;
-    write.descriptorCount = 1;
-    write.pImageInfo = &info;
+    write.setImageInfo(m_pending);
     m_device->updateDescriptorSets(write, nullptr);
-
-    return index;
+    m_pending.clear();
 }
 
 vk::raii::Sampler TextureMap::create_sampler(VulkanDevice &device) {
@@ -79,36 +92,61 @@ vk::raii::Sampler TextureMap::create_sampler(VulkanDevice &device) {
         properties.properties.limits.maxSamplerAnisotropy;
 
     vk::SamplerCreateInfo info;
+    // Magnification keeps texels crisp; minification blends between
+    // mip levels so distant terrain doesn't alias
     info.magFilter = vk::Filter::eNearest;
-    info.minFilter = vk::Filter::eNearest;
-    info.mipmapMode = vk::SamplerMipmapMode::eNearest;
+    info.minFilter = vk::Filter::eLinear;
+    info.mipmapMode = vk::SamplerMipmapMode::eLinear;
     info.addressModeU = vk::SamplerAddressMode::eRepeat;
     info.addressModeV = vk::SamplerAddressMode::eRepeat;
     info.addressModeW = vk::SamplerAddressMode::eRepeat;
     info.anisotropyEnable = 1;
     info.maxAnisotropy = max_anisotropy;
-    info.maxLod = 30.0;
+    info.minLod = 0.0;
+    info.maxLod = VK_LOD_CLAMP_NONE;
     auto sampler = device->createSampler(info, nullptr);
     device.set_name(*sampler, "TextureMap.m_sampler");
     return sampler;
 }
 
-uint32_t TextureMap::get(const std::string &path) {
-    auto result = m_entry_map.find(path);
-    if (result != m_entry_map.end()) {
-        return m_entries[result->second].id;
+bool TextureArray::matches(const ImageDesc &src) const {
+    return src.width == image.width() && src.height == image.height() &&
+           format_to_vk(src.format) == image.format();
+}
+
+uint32_t TextureMap::mip_levels(const ImageDesc &src) const {
+    // Precomputed mips are used as is; compressed formats can't be
+    // blitted to, so they only ever have the mips they came with
+    if (src.mip_levels > 1 || format_compressed(src.format)) {
+        return src.mip_levels;
+    }
+
+    // Mips are generated by linear blits, which not every format
+    // supports
+    const auto format = format_to_vk(src.format);
+    const auto properties =
+        m_device.physical_device().getFormatProperties(format);
+    const auto required = vk::FormatFeatureFlagBits::eBlitSrc |
+                          vk::FormatFeatureFlagBits::eBlitDst |
+                          vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+    if ((properties.optimalTilingFeatures & required) != required) {
+        return 1;
     }
+    return std::bit_width(std::max(src.width, src.height));
+}
 
-    const auto src = m_assets.load_image(path);
+TextureArray &TextureMap::create_array(const ImageDesc &src) {
+    const vk::DeviceSize layer_size = src.size();
+    const auto layers = (uint32_t)std::clamp<vk::DeviceSize>(
+        TEXTURE_ARRAY_MAX_BYTES / layer_size, 1, TEXTURE_ARRAY_MAX_LAYERS);
 
     // Step 1: Create and allocate image
     vk::ImageCreateInfo info;
     info.imageType = vk::ImageType::e2D;
-    info.format = format_to_vk(src.format());
-    info.extent = vk::Extent3D(src.width(), src.height(), 1);
-    // TODO: mipmapping
-    info.mipLevels = 1;
-    info.arrayLayers = 1;
+    info.format = format_to_vk(src.format);
+    info.extent = vk::Extent3D(src.width, src.height, 1);
+    info.mipLevels = mip_levels(src);
+    info.arrayLayers = layers;
     info.samples = vk::SampleCountFlagBits::e1;
     info.tiling = vk::ImageTiling::eOptimal;
     info.usage = vk::ImageUsageFlagBits::eSampled |
@@ -120,31 +158,187 @@ uint32_t TextureMap::get(const std::string &path) {
     memset(&alloc_info, 0, sizeof(VmaAllocationCreateInfo));
     alloc_info.usage = VMA_MEMORY_USAGE_AUTO;
     auto image = VulkanAllocator::create_image(m_allocator, info, alloc_info);
+    // The descriptor covers every layer, including those nothing has
+    // been uploaded to yet
+    m_staging.initialize_image(image, vk::ImageLayout::eShaderReadOnlyOptimal);
 
     // Step 2: Create image view
     vk::ImageViewCreateInfo view_info;
     view_info.image = *image;
-    view_info.viewType = vk::ImageViewType::e2D;
+    view_info.viewType = vk::ImageViewType::e2DArray;
     view_info.format = info.format;
     view_info.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
     view_info.subresourceRange.baseMipLevel = 0;
-    view_info.subresourceRange.levelCount = 1;
+    view_info.subresourceRange.levelCount = info.mipLevels;
     view_info.subresourceRange.baseArrayLayer = 0;
-    view_info.subresourceRange.layerCount = 1;
+    view_info.subresourceRange.layerCount = layers;
     auto view = m_device->createImageView(view_info, nullptr);
 
     // Step 3: Write the descriptor
-    const auto id = m_descriptor_heap.add(view, m_sampler);
-    m_device.set_name(*image, std::format("TextureMap[{}].image", id).c_str());
-    m_device.set_name(*view, std::format("TextureMap[{}].view", id).c_str());
-
-    // Step 4: Add the entry
-    TextureMapEntry entry{id, path, std::move(image), std::move(view)};
-    entry.upload_batch = m_staging.stage_image(src, entry.image);
-    m_entries.push_back(std::move(entry));
-    m_entry_map.insert({path, id});
-
-    // The image can now be read in shaders by indexing the samplers
-    // uniform array at this index
+    const auto descriptor = m_descriptor_heap.add(view, m_sampler);
+    m_device.set_name(*image,
+                      std::format("TextureMap[{}].image", descriptor).c_str());
+    m_device.set_name(*view,
+                      std::format("TextureMap[{}].view", descriptor).c_str());
+
+    m_arrays.emplace_back(std::move(image), std::move(view), descriptor);
+    return m_arrays.back();
+}
+
+TextureArray &TextureMap::find_array(const ImageDesc &src) {
+    // There are only ever a handful of distinct texture sizes, so a
+    // linear search is plenty
+    for (auto &array : m_arrays) {
+        if (array.matches(src) && !array.full() &&
+            array.image.mip_levels() == mip_levels(src)) {
+            return array;
+        }
+    }
+    return create_array(src);
+}
+
+std::string TextureMap::source_path(const std::string &path) {
+    // Prefer a precompressed .tex next to the PNG, which skips decoding
+    // entirely
+    const std::string png_extension = ".png";
+    if (m_device.texture_compression_bc() && path.ends_with(png_extension)) {
+        const auto tex_path =
+            path.substr(0, path.size() - png_extension.size()) + ".tex";
+        if (m_assets.exists(tex_path)) {
+            return tex_path;
+        }
+    }
+    return path;
+}
+
+AssetView TextureMap::load_source(const std::string &path) {
+    // Only looked up here, so concurrent calls don't race; the entry is
+    // erased once the texture is inserted
+    const auto prefetched = m_prefetched.find(path);
+    if (prefetched != m_prefetched.end()) {
+        return prefetched->second.get();
+    }
+    return m_assets.load_blob(source_path(path));
+}
+
+std::span<char> TextureMap::insert(const std::string &path,
+                                   const ImageDesc &src) {
+    auto &array = find_array(src);
+    const auto layer = array.layers;
+    array.layers++;
+
+    const auto id = texture_id(array.descriptor, layer);
+    const auto staged = m_staging.reserve_image(
+        src, array.image, layer, array.image.mip_levels() > src.mip_levels);
+    m_entry_map.insert({path, m_entries.size()});
+    m_entries.push_back({id, path, staged.batch});
+
+    // Once the heap is flushed and the pixels are written, the texture
+    // can be sampled in shaders from layer `id & 0xffff` of the array at
+    // index `id >> 16` of the textures uniform array
+    return staged.data;
+}
+
+void TextureMap::remove(std::span<const std::string> paths) {
+    for (const auto &path : paths) {
+        m_entry_map.erase(path);
+    }
+    std::erase_if(m_entries, [this](const TextureMapEntry &entry) {
+        return !m_entry_map.contains(entry.path);
+    });
+    for (size_t i = 0; i < m_entries.size(); i++) {
+        m_entry_map[m_entries[i].path] = (uint32_t)i;
+    }
+}
+
+uint32_t TextureMap::get(const std::string &path) {
+    auto result = m_entry_map.find(path);
+    if (result != m_entry_map.end()) {
+        return m_entries[result->second].id;
+    }
+
+    const auto source = load_source(path);
+    m_prefetched.erase(path);
+    const auto out = insert(path, Image::peek(source));
+    const auto id = m_entries.back().id;
+    // The array may be new; its descriptor is needed either way
+    m_descriptor_heap.flush();
+    try {
+        Image::decode_into(source, out);
+    } catch (...) {
+        // Don't hand out the id of a layer that was never written
+        remove({&path, 1});
+        throw;
+    }
     return id;
 }
+
+void TextureMap::preload(std::span<const std::string> paths,
+                         JobSystem &jobs) {
+    std::vector<std::string> pending;
+    for (const auto &path : paths) {
+        if (!m_entry_map.contains(path) &&
+            std::find(pending.begin(), pending.end(), path) == pending.end()) {
+            pending.push_back(path);
+        }
+    }
+    if (pending.empty()) {
+        return;
+    }
+
+    // Step 1: Read every file and its header in parallel. Asset
+    // resolvers only read, so they can be shared between threads.
+    std::vector<AssetView> sources(pending.size());
+    std::vector<ImageDesc> descs(pending.size());
+    jobs.parallel_for(pending.size(), [&](size_t i) {
+        sources[i] = load_source(pending[i]);
+        descs[i] = Image::peek(sources[i]);
+    });
+    for (const auto &path : pending) {
+        m_prefetched.erase(path);
+    }
+
+    // Step 2: Reserve staging memory and array layers on this thread
+    std::vector<std::span<char>> outputs;
+    for (size_t i = 0; i < pending.size(); i++) {
+        outputs.push_back(insert(pending[i], descs[i]));
+    }
+
+    // Step 3: Decode straight into the staging buffer in parallel, then
+    // write every descriptor in one batch. Failures are collected per
+    // texture so that exactly the failed entries can be removed.
+    std::vector<std::exception_ptr> errors(pending.size());
+    jobs.parallel_for(pending.size(), [&](size_t i) {
+        try {
+            Image::decode_into(sources[i], outputs[i]);
+        } catch (...) {
+            errors[i] = std::current_exception();
+        }
+    });
+    m_descriptor_heap.flush();
+
+    std::vector<std::string> failed;
+    std::exception_ptr first_error;
+    for (size_t i = 0; i < pending.size(); i++) {
+        if (errors[i]) {
+            failed.push_back(pending[i]);
+            if (!first_error) {
+                first_error = errors[i];
+            }
+        }
+    }
+    if (first_error) {
+        remove(failed);
+        std::rethrow_exception(first_error);
+    }
+}
+
+void TextureMap::prefetch(std::span<const std::string> paths,
+                          AsyncAssetLoader &loader) {
+    for (const auto &path : paths) {
+        if (m_entry_map.contains(path) || m_prefetched.contains(path)) {
+            continue;
+        }
+        m_prefetched.insert({path, loader.load(source_path(path))});
+    }
+}
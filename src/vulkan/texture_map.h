@@ -4,6 +4,7 @@
 #include <cstdint>
 #include <memory>
 #include <optional>
+#include <span>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -11,7 +12,9 @@
 #include <vulkan/vulkan_raii.hpp>
 
 #include "asset.h"
+#include "asset_loader.h"
 #include "image.h"
+#include "jobs.h"
 #include "vulkan/device.h"
 #include "vulkan/memory.h"
 #include "vulkan/staging.h"
@@ -19,17 +22,39 @@
 struct TextureMapEntry {
     uint32_t id;
     std::string path;
+    uint64_t upload_batch;
+};
+
+/// @brief A 2D array image holding textures of a single size and
+/// format, one per layer. The whole array is bound through a single
+/// descriptor.
+struct TextureArray {
     VulkanImage image;
     vk::raii::ImageView view;
-    uint64_t upload_batch;
+    uint32_t descriptor;
+    uint32_t layers = 0;
+
+    TextureArray(VulkanImage image, vk::raii::ImageView view,
+                 uint32_t descriptor)
+        : image{std::move(image)}, view{std::move(view)},
+          descriptor{descriptor} {}
 
-    TextureMapEntry(uint32_t id, std::string path, VulkanImage image,
-                    vk::raii::ImageView view)
-        : id{id}, path{std::move(path)}, image{std::move(image)},
-          view{std::move(view)} {}
+    bool matches(const ImageDesc &src) const;
+    bool full() const { return layers == image.array_layers(); }
 };
 
 const size_t TEXTURE_MAP_MAX_ENTRIES = 4096;
+/// Upper bound on the number of layers in a texture array.
+const uint32_t TEXTURE_ARRAY_MAX_LAYERS = 256;
+/// Upper bound on the size of a texture array, so that large textures
+/// don't reserve huge arrays for layers that may never be used.
+const vk::DeviceSize TEXTURE_ARRAY_MAX_BYTES = 0x100'0000;
+
+/// @brief Texture ids pack the descriptor of the array in the high 16
+/// bits and the layer in the low 16 bits.
+inline uint32_t texture_id(uint32_t descriptor, uint32_t layer) {
+    return (descriptor << 16) | layer;
+}
 
 class TextureMap;
 
@@ -42,6 +67,10 @@ class ImageDescriptorHeap {
     vk::raii::DescriptorPool m_pool;
     vk::raii::DescriptorSet m_set;
     uint32_t m_index = 0;
+    // Descriptors added since the last flush. Indices are handed out
+    // sequentially, so these always form one contiguous range.
+    std::vector<vk::DescriptorImageInfo> m_pending;
+    uint32_t m_pending_start = 0;
 
     friend class TextureMap;
 
@@ -59,9 +88,12 @@ public:
     const vk::DescriptorSet &descriptor_set() const { return *m_set; }
 
     /// @brief Adds an image to the heap and returns the offset of the
-    /// descriptor for use in shaders.
+    /// descriptor for use in shaders. The descriptor is not written
+    /// until the next flush.
     uint32_t add(const vk::raii::ImageView &view,
                  const vk::raii::Sampler &sampler);
+    /// @brief Writes all pending descriptors in a single update.
+    void flush();
 };
 
 class TextureMap {
@@ -71,10 +103,27 @@ class TextureMap {
     StagingBuffer &m_staging;
     ImageDescriptorHeap m_descriptor_heap;
     vk::raii::Sampler m_sampler;
+    std::vector<TextureArray> m_arrays;
     std::vector<TextureMapEntry> m_entries;
     std::unordered_map<std::string, uint32_t> m_entry_map;
+    // Loads started by prefetch, consumed by the next get or preload of
+    // the same path
+    std::unordered_map<std::string, AssetFuture> m_prefetched;
 
     static vk::raii::Sampler create_sampler(VulkanDevice &device);
+    uint32_t mip_levels(const ImageDesc &src) const;
+    TextureArray &create_array(const ImageDesc &src);
+    TextureArray &find_array(const ImageDesc &src);
+    std::string source_path(const std::string &path);
+    /// @brief Reads the file for `path`. Safe to call from several
+    /// threads at once as long as prefetch isn't called meanwhile.
+    AssetView load_source(const std::string &path);
+    /// @brief Adds an entry for the texture and returns the staging
+    /// memory its pixels must be decoded into.
+    std::span<char> insert(const std::string &path, const ImageDesc &src);
+    /// @brief Removes the entries for `paths`, e.g. after their pixels
+    /// failed to decode. Their array layers are not reused.
+    void remove(std::span<const std::string> paths);
 
 public:
     TextureMap(AssetApi &assets, std::shared_ptr<VulkanAllocator> allocator,
@@ -86,7 +135,19 @@ public:
 
     const ImageDescriptorHeap &heap() const { return m_descriptor_heap; }
 
+    /// @brief Loads the texture at `path` into a texture array if it
+    /// isn't loaded yet and returns its texture id.
     uint32_t get(const std::string &path);
+    /// @brief Loads every texture in `paths` that isn't loaded yet.
+    /// Files are read and decoded in parallel, straight into staging
+    /// memory. Must be called while staging, from a thread that can
+    /// wait on `jobs`.
+    void preload(std::span<const std::string> paths, JobSystem &jobs);
+    /// @brief Starts reading the files for `paths` on the I/O threads of
+    /// `loader`, so that a later get or preload doesn't have to wait on
+    /// the disk. Doesn't need staging.
+    void prefetch(std::span<const std::string> paths,
+                  AsyncAssetLoader &loader);
 };
 
 #endif